@@ -0,0 +1,146 @@
+#pragma once
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include "matrix.h"
+#include "gemm.hpp"
+#include "boxfilter.hpp"
+
+namespace fkZQ
+{
+    // count matrices of one shape in a single aligned slab: item i is rows [i * rows, (i + 1) * rows) of a
+    // (count * rows) x cols x channels matrix, so the items share one allocation and the padding of one step.
+    // elementwise work runs on the slab in one call, the other operations split the items over the threads
+    template <typename T>
+    class MatrixBatch
+    {
+    public:
+        size_t count, rows, cols, channels;
+        Matrix<T> slab;
+
+        MatrixBatch() : count(0), rows(0), cols(0), channels(1) {}
+        MatrixBatch(size_t _count, size_t _rows, size_t _cols, size_t _channels = 1)
+            : count(_count), rows(_rows), cols(_cols), channels(_channels), slab(_count * _rows, _cols, _channels) {}
+        // copies same-shape matrices into one slab
+        explicit MatrixBatch(const std::vector<Matrix<T>> &items) : MatrixBatch()
+        {
+            if (items.empty())
+                return;
+            *this = MatrixBatch(items.size(), items[0].rows, items[0].cols, items[0].channels);
+            for (size_t i = 0; i < this->count; ++i)
+            {
+                assert(items[i].rows == this->rows && items[i].cols == this->cols && items[i].channels == this->channels);
+                memcpy(this->item(i), items[i].data(), items[i].size);
+            }
+        }
+        // the batch of a slab holding _count items, sharing it
+        MatrixBatch(const Matrix<T> &_slab, size_t _count)
+            : count(_count), rows(_count ? _slab.rows / _count : 0), cols(_slab.cols), channels(_slab.channels), slab(_slab)
+        {
+            assert(_count == 0 || _slab.rows % _count == 0);
+        }
+
+        // elements from one item to the next
+        size_t itemStep() const { return this->rows * this->slab.step; }
+        T *item(size_t i) { return this->slab.data() + i * this->itemStep(); }
+        const T *item(size_t i) const { return this->slab.data() + i * this->itemStep(); }
+
+        // item i in place, without a copy: writes go to the slab, and the view must not outlive it. a slab shared
+        // with copies of the batch is detached first, but the view is not counted as a copy: after
+        // Matrix<T> w = c[1]; d = c; a write through w changes both c and d
+        Matrix<T> operator[](size_t i)
+        {
+            assert(i < this->count);
+            return Matrix<T>::wrap(this->rows, this->cols, this->channels, this->item(i));
+        }
+        // item i read in place, a write to the view copies it and leaves the slab alone
+        const Matrix<T> operator[](size_t i) const
+        {
+            assert(i < this->count);
+            return Matrix<T>::wrapReadOnly(this->rows, this->cols, this->channels, this->item(i));
+        }
+
+        MatrixBatch<T> clone() const { return MatrixBatch<T>(this->slab.clone(), this->count); }
+
+        MatrixBatch<T> operator+(const MatrixBatch<T> &other) const { return this->elementwise(other, [](Matrix<T> a, const Matrix<T> &b) { return a + b; }); }
+        MatrixBatch<T> operator-(const MatrixBatch<T> &other) const { return this->elementwise(other, [](Matrix<T> a, const Matrix<T> &b) { return a - b; }); }
+        MatrixBatch<T> mul(const MatrixBatch<T> &other) const { return this->elementwise(other, [](Matrix<T> a, const Matrix<T> &b) { return a.mul(b); }); }
+        MatrixBatch<T> operator/(const MatrixBatch<T> &other) const { return this->elementwise(other, [](Matrix<T> a, const Matrix<T> &b) { return a / b; }); }
+        MatrixBatch<T> operator+(const T &v) const { return MatrixBatch<T>(Matrix<T>(this->slab) + v, this->count); }
+        MatrixBatch<T> operator-(const T &v) const { return MatrixBatch<T>(Matrix<T>(this->slab) - v, this->count); }
+        MatrixBatch<T> operator*(const T &v) const { return MatrixBatch<T>(Matrix<T>(this->slab) * v, this->count); }
+        MatrixBatch<T> operator/(const T &v) const { return MatrixBatch<T>(Matrix<T>(this->slab) / v, this->count); }
+
+        // item-wise transpose, each item is small enough to stay in L1 without tiling
+        MatrixBatch<T> transpose() const
+        {
+            MatrixBatch<T> ret(this->count, this->cols, this->rows, this->channels);
+            size_t cn = this->channels;
+            size_t sstep = this->slab.step, dstep = ret.slab.step;
+            // the slab pointer is taken once, item() from the threads would detach it concurrently
+            T *base = ret.slab.data();
+#pragma omp parallel for schedule(static) if (this->count * this->rows * this->cols * cn >= FKZQ_PARALLEL_THRESHOLD)
+            for (long b = 0; b < (long)this->count; ++b)
+            {
+                const T *src = this->item(b);
+                T *dst = base + b * ret.itemStep();
+                for (size_t i = 0; i < this->rows; ++i)
+                {
+                    for (size_t j = 0; j < this->cols; ++j)
+                    {
+                        for (size_t c = 0; c < cn; ++c)
+                        {
+                            dst[j * dstep + i * cn + c] = src[i * sstep + j * cn + c];
+                        }
+                    }
+                }
+            }
+            return ret;
+        }
+
+        // item-wise product, through gemm_batched
+        MatrixBatch<T> operator*(const MatrixBatch<T> &other) const
+        {
+            assert(this->count == other.count && this->channels == 1 && other.channels == 1 && this->cols == other.rows);
+            MatrixBatch<T> ret(this->count, this->rows, other.cols);
+            gemm_batched(this->count, this->rows, other.cols, this->cols, this->slab.data(), this->slab.step, this->itemStep(),
+                         other.slab.data(), other.slab.step, other.itemStep(), ret.slab.data(), ret.slab.step, ret.itemStep());
+            return ret;
+        }
+        // every item times the same matrix
+        MatrixBatch<T> operator*(const Matrix<T> &b) const
+        {
+            assert(this->channels == 1 && b.channels == 1 && this->cols == b.rows);
+            MatrixBatch<T> ret(this->count, this->rows, b.cols);
+            gemm_batched(this->count, this->rows, b.cols, this->cols, this->slab.data(), this->slab.step, this->itemStep(),
+                         b.data(), b.step, (size_t)0, ret.slab.data(), ret.slab.step, ret.itemStep());
+            return ret;
+        }
+
+    private:
+        template <typename F>
+        MatrixBatch<T> elementwise(const MatrixBatch<T> &other, F f) const
+        {
+            assert(this->count == other.count && this->rows == other.rows && this->cols == other.cols && this->channels == other.channels);
+            return MatrixBatch<T>(f(this->slab, other.slab), this->count);
+        }
+    };
+}
+
+// box filter of every item, the items are split over the threads and each is filtered serially
+template <typename IT, typename ST>
+void box_filter_s(const fkZQ::MatrixBatch<IT> &batch, fkZQ::MatrixBatch<ST> &result, int k_size)
+{
+    if (result.count != batch.count || result.rows != batch.rows || result.cols != batch.cols || result.channels != batch.channels)
+        result = fkZQ::MatrixBatch<ST>(batch.count, batch.rows, batch.cols, batch.channels);
+    size_t work = batch.count * batch.rows * batch.cols * batch.channels * k_size;
+    // a shared result slab is detached here once, not from every thread
+    ST *base = result.slab.data();
+#pragma omp parallel for schedule(static) if (work >= FKZQ_PARALLEL_THRESHOLD)
+    for (long b = 0; b < (long)batch.count; ++b)
+    {
+        // the views write into the result slab, box_filter_s does not reallocate a result of the right shape
+        Matrix<ST> dst = Matrix<ST>::wrap(result.rows, result.cols, result.channels, base + b * result.itemStep());
+        box_filter_s(batch[b], dst, k_size);
+    }
+}
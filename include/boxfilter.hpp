@@ -1,12 +1,22 @@
 #pragma once
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
 #include "matrix.h"
 
 using fkZQ::Matrix;
 using fkZQ::AlignedMalloc;
 using fkZQ::AlignedFree;
 using uchar = unsigned char;
-int *get_pos(int L, int k)
+
+#ifndef FKZQ_TEMPORAL_RESYNC
+#define FKZQ_TEMPORAL_RESYNC 1024 // frames between exact re-summations of a floating-point temporal running sum
+#endif
+
+inline int *get_pos(int L, int k)
 {
+    assert(k <= L);
     int *pos = (int *)malloc((L + 2 * k) * sizeof(int));
     for (int i = 0; i < k; i++)
         pos[i] = k - 1 - i;
@@ -17,93 +27,476 @@ int *get_pos(int L, int k)
     return pos;
 }
 
+// dst[0:width_ * cn] = horizontal window sums of one source row, reflected at the borders. data_ holds the
+// padded row, diff_ the change of the sum between neighbouring windows
+template <typename IT, typename ST>
+inline void box_row_sum(const IT *src, ST *dst, IT *data_, ST *diff_, const int *pos_row, int width_, int k, int cn)
+{
+    int k_size = 2 * k + 1;
+    int width = width_ + 2 * k;
+    // copy data, border pixels keep their channels together
+    for (int i = 0; i < k; i++)
+        memcpy(data_ + i * cn, src + pos_row[i] * cn, cn * sizeof(IT));
+    for (int i = width_ + k; i < width; i++)
+        memcpy(data_ + i * cn, src + pos_row[i] * cn, cn * sizeof(IT));
+    memcpy(data_ + k * cn, src, width_ * cn * sizeof(IT));
+
+    // diff along current row, the window of an element moves by one pixel = cn elements
+    for (int i = 0; i < (width_ - 1) * cn; i++)
+        diff_[i] = (ST)data_[i + k_size * cn] - (ST)data_[i];
+
+    // sum along current row, with windows_size = k_size
+    for (int c = 0; c < cn; c++)
+    {
+        ST tmp = 0;
+        for (int i = 0; i < k_size; i++)
+            tmp += (ST)data_[i * cn + c];
+        dst[c] = tmp;
+    }
+    for (int i = cn; i < width_ * cn; i++)
+        dst[i] = dst[i - cn] + diff_[i - cn];
+}
+
+// the output is computed in strips of rows (Params().box_strip, by default as many as fit with their row sums
+// in half of L2). a strip computes the horizontal sums of its rows plus the 2k rows around it, so the vertical
+// pass reads them from cache, and the strips run in parallel
 template <typename IT, typename ST>
-void box_filter_s(Matrix<IT> &img_, Matrix<ST> &result, int k_size)
+void box_filter_s(const Matrix<IT> &img_, Matrix<ST> &result, int k_size)
 {
     assert(img_.isContinuous());
     int width_ = img_.cols;
     int height_ = img_.rows;
+    int cn = img_.channels;
 
     int k = k_size / 2;
     k_size = 2 * k + 1;
-    float ks = 1.0 / ((2 * k + 1) * (2 * k + 1));
+    ST ks = (ST)(1.0f / ((2 * k + 1) * (2 * k + 1)));
     int width = width_ + 2 * k;
-    int height = height_ + 2 * k;
     int *pos_row = get_pos(width_, k);
     int *pos_col = get_pos(height_, k);
 
-    uchar *buffer = nullptr;
-    uchar *data = nullptr;
-    uchar *diff = nullptr;
-    Matrix<ST> sum;
     if (result.empty())
-        result.create(height_, width_);
+        result.create(height_, width_, cn);
     else
     {
-        if (result.row() != height_ || result.col() != width_)
-            result.create(height_, width_);
+        if (result.row() != height_ || result.col() != width_ || result.channels != cn)
+            result.create(height_, width_, cn);
     }
-    sum.create(height, width);
-
-    buffer = (uchar *)AlignedMalloc<ST>(width_ * sizeof(ST));
-    data = (uchar *)AlignedMalloc<IT>(width * sizeof(IT));
-    diff = (uchar *)AlignedMalloc<ST>((width_ - 1) * sizeof(ST));
-    ST *buffer_ = (ST *)buffer;
-    IT *data_ = (IT *)data;
-    ST *diff_ = (ST *)diff;
-    ST tmp;
-    // #pragma omp parallel for
-    for (int j = 0; j < height_; j++)
+    // row sums are stored with the aligned step of the result
+    size_t line = result.step;
+    size_t strip = fkZQ::Params().box_strip[fkZQ::TypeClass(sizeof(ST))];
+    if (strip == 0)
+        strip = fkZQ::CacheSize(2) / 2 / (line * sizeof(ST));
+    strip = std::min<size_t>(std::max<size_t>(strip, std::max(16, 2 * k)), height_);
+    long strips = (long)((height_ + strip - 1) / strip);
+    const IT *src = img_.data();
+    ST *out = result.data();
+
+#pragma omp parallel if ((size_t)height_ * width_ * cn * k_size >= FKZQ_PARALLEL_THRESHOLD)
     {
-        IT *LinePS = img_.ptr(j);
-        ST *LinePD = sum.ptr(j);
-        // copy data
-        for (int i = 0; i < k; i++)
-            data_[i] = LinePS[pos_row[i]];
-        for (int i = width_ + k; i < width; i++)
-            data_[i] = LinePS[pos_row[i]];
-        memcpy(data_ + k, LinePS, width_ * sizeof(IT));
-
-        // diff along current row
-        for (int i = 0; i < width_ - 1; i++)
-            diff_[i] = (ST)data_[i + k_size] - (ST)data_[i];
-
-        // sum along current row, with windows_size = k_size
-        tmp = 0;
-        for (int i = 0; i < k_size; i++)
-            tmp += (ST)data_[i];
-        LinePD[0] = tmp;
-        for (int i = 1; i < width; i++)
+        IT *data_ = (IT *)AlignedMalloc<IT>(width * cn * sizeof(IT), false);
+        ST *diff_ = (ST *)AlignedMalloc<ST>(std::max(width_ - 1, 1) * cn * sizeof(ST), false);
+        ST *buffer_ = (ST *)AlignedMalloc<ST>(line * sizeof(ST), false);
+        ST *rows_ = (ST *)AlignedMalloc<ST>((strip + 2 * k) * line * sizeof(ST), false);
+        // the vertical pass works on whole rows, channels need no special care
+        int n = width_ * cn;
+#pragma omp for schedule(static)
+        for (long s = 0; s < strips; s++)
         {
-            tmp += diff_[i - 1];
-            LinePD[i] = tmp;
+            int j0 = s * strip;
+            int j1 = std::min<int>(j0 + strip, height_);
+            // padded rows j0 .. j1 + 2k - 1 feed output rows j0 .. j1 - 1
+            for (int p = j0; p < j1 + 2 * k; p++)
+                box_row_sum(src + pos_col[p] * img_.step, rows_ + (p - j0) * line, data_, diff_, pos_row, width_, k, cn);
+
+            // sum along col, first k_size-1 rows
+            memset(buffer_, 0, sizeof(ST) * n);
+            for (int j = 0; j < k_size - 1; j++)
+            {
+                ST *LinePS = rows_ + j * line;
+                for (int i = 0; i < n; i++)
+                    buffer_[i] += LinePS[i];
+            }
+            for (int j = j0; j < j1; j++)
+            {
+                ST *LinePD = out + j * result.step;
+                ST *LineADD = rows_ + (j - j0 + k_size - 1) * line;
+                ST *LineSUB = rows_ + (j - j0) * line;
+                for (int i = 0; i < n; i++)
+                {
+                    ST tmp = buffer_[i] + LineADD[i];
+                    LinePD[i] = tmp * ks;
+                    buffer_[i] = tmp - LineSUB[i];
+                }
+            }
         }
+        AlignedFree(data_);
+        AlignedFree(diff_);
+        AlignedFree(buffer_);
+        AlignedFree(rows_);
     }
-    memset(buffer_, 0, sizeof(ST) * width_);
-    // sum along col, first k_size-1 rows
-    for (int j = 0; j < k_size - 1; j++)
+    free(pos_row);
+    free(pos_col);
+}
+
+struct MinOp
+{
+    template <typename T>
+    T operator()(T a, T b) const { return b < a ? b : a; }
+#ifdef _FKZQ_USE_SIMD
+    template <typename T>
+    simd<T> operator()(const simd<T> &a, const simd<T> &b) const { return stdx::min(a, b); }
+#endif
+};
+
+struct MaxOp
+{
+    template <typename T>
+    T operator()(T a, T b) const { return a < b ? b : a; }
+#ifdef _FKZQ_USE_SIMD
+    template <typename T>
+    simd<T> operator()(const simd<T> &a, const simd<T> &b) const { return stdx::max(a, b); }
+#endif
+};
+
+// out[0:n] = op(a[0:n], b[0:n])
+template <typename T, typename Op>
+inline void minmax_line(const T *a, const T *b, T *out, int n, Op op)
+{
+    int i = 0;
+#ifdef _FKZQ_USE_SIMD
+    constexpr int W = simd<T>::size();
+    for (; i + W <= n; i += W)
+        op(simd<T>(a + i, stdx::element_aligned), simd<T>(b + i, stdx::element_aligned)).copy_to(out + i, stdx::element_aligned);
+#endif
+    for (; i < n; i++)
+        out[i] = op(a[i], b[i]);
+}
+
+// rectangular min (MinOp) or max (MaxOp) filter with reflected borders. van Herk/Gil-Werman: the padded line is cut
+// into blocks of the window length, a prefix and a suffix running extremum per block give every window with two
+// lookups, so the cost per pixel does not depend on the window size. rows are filtered with scalars, columns with
+// simd across the row
+template <typename T, typename Op>
+void minmax_filter_s(const Matrix<T> &img_, Matrix<T> &result, int k_w, int k_h, Op op)
+{
+    int width_ = img_.cols;
+    int height_ = img_.rows;
+    int cn = img_.channels;
+    int kx = k_w / 2, ky = k_h / 2;
+    int wx = 2 * kx + 1, wy = 2 * ky + 1;
+    int width = width_ + 2 * kx;
+    int height = height_ + 2 * ky;
+    int *pos_row = get_pos(width_, kx);
+    int *pos_col = get_pos(height_, ky);
+
+    if (result.row() != height_ || result.col() != width_ || result.channels != cn)
+        result.create(height_, width_, cn);
+    Matrix<T> line(height_, width_, cn);
+    // buffers are taken once, ptr() from the threads would detach a shared result concurrently
+    T *lines = line.data();
+    T *out = result.data();
+
+    // horizontal pass
+#pragma omp parallel if ((size_t)width * height_ >= FKZQ_PARALLEL_THRESHOLD)
     {
-        ST *LinePS = sum.ptr(pos_col[j]);
-        for (int i = 0; i < width_; i++)
-            buffer_[i] += LinePS[i];
+        T *data_ = (T *)AlignedMalloc<T>(width * cn * sizeof(T), false);
+        T *g = (T *)AlignedMalloc<T>(width * cn * sizeof(T), false);
+        T *h = (T *)AlignedMalloc<T>(width * cn * sizeof(T), false);
+#pragma omp for schedule(static)
+        for (int j = 0; j < height_; j++)
+        {
+            const T *LinePS = img_.ptr(j);
+            T *LinePD = lines + j * line.step;
+            for (int i = 0; i < kx; i++)
+                memcpy(data_ + i * cn, LinePS + pos_row[i] * cn, cn * sizeof(T));
+            for (int i = width_ + kx; i < width; i++)
+                memcpy(data_ + i * cn, LinePS + pos_row[i] * cn, cn * sizeof(T));
+            memcpy(data_ + kx * cn, LinePS, width_ * cn * sizeof(T));
+            for (int i = 0; i < width; i++)
+                for (int c = i * cn; c < (i + 1) * cn; c++)
+                    g[c] = i % wx == 0 ? data_[c] : op(g[c - cn], data_[c]);
+            for (int i = width - 1; i >= 0; i--)
+                for (int c = i * cn; c < (i + 1) * cn; c++)
+                    h[c] = i % wx == wx - 1 || i == width - 1 ? data_[c] : op(h[c + cn], data_[c]);
+            for (int i = 0; i < width_ * cn; i++)
+                LinePD[i] = op(h[i], g[i + (wx - 1) * cn]);
+        }
+        AlignedFree(data_);
+        AlignedFree(g);
+        AlignedFree(h);
     }
 
+    // vertical pass, prefix and suffix rows of every block of wy padded rows
+    width_ *= cn;
+    Matrix<T> g(height, width_);
+    Matrix<T> h(height, width_);
+    T *gs = g.data();
+    T *hs = h.data();
+    size_t gstep = g.step, lstep = line.step;
+    int blocks = (height + wy - 1) / wy;
+    bool parallel = (size_t)width_ * height >= FKZQ_PARALLEL_THRESHOLD;
+#pragma omp parallel for schedule(static) if (parallel)
+    for (int b = 0; b < blocks; b++)
+    {
+        int p0 = b * wy;
+        int p1 = std::min(p0 + wy, height);
+        memcpy(gs + p0 * gstep, lines + pos_col[p0] * lstep, width_ * sizeof(T));
+        for (int p = p0 + 1; p < p1; p++)
+            minmax_line(gs + (p - 1) * gstep, lines + pos_col[p] * lstep, gs + p * gstep, width_, op);
+        memcpy(hs + (p1 - 1) * gstep, lines + pos_col[p1 - 1] * lstep, width_ * sizeof(T));
+        for (int p = p1 - 2; p >= p0; p--)
+            minmax_line(hs + (p + 1) * gstep, lines + pos_col[p] * lstep, hs + p * gstep, width_, op);
+    }
+#pragma omp parallel for schedule(static) if (parallel)
     for (int j = 0; j < height_; j++)
+        minmax_line(hs + j * gstep, gs + (j + wy - 1) * gstep, out + j * result.step, width_, op);
+
+    free(pos_row);
+    free(pos_col);
+}
+
+template <typename T>
+void erode_s(const Matrix<T> &img_, Matrix<T> &result, int k_w, int k_h = -1)
+{
+    minmax_filter_s(img_, result, k_w, k_h < 0 ? k_w : k_h, MinOp());
+}
+
+template <typename T>
+void dilate_s(const Matrix<T> &img_, Matrix<T> &result, int k_w, int k_h = -1)
+{
+    minmax_filter_s(img_, result, k_w, k_h < 0 ? k_w : k_h, MaxOp());
+}
+
+// running sums of a temporal filter: exact integers for 8 and 16 bit input, the input type otherwise
+template <typename T>
+struct TemporalAccum
+{
+    using type = T;
+};
+template <>
+struct TemporalAccum<uchar>
+{
+    using type = unsigned int;
+};
+template <>
+struct TemporalAccum<unsigned short>
+{
+    using type = unsigned int;
+};
+template <>
+struct TemporalAccum<short>
+{
+    using type = int;
+};
+
+// one frame step of a row of running sums: sum[0:n] = prev + x - old (old is nullptr while the window fills),
+// the frame is kept in keep and the average sum * scale written to out when they are not nullptr
+template <typename IT, typename AT, typename ST>
+inline void temporal_row(const AT *prev, const IT *x, const IT *old, AT *sum, IT *keep, ST *out, ST scale, int n)
+{
+    int i = 0;
+#ifdef _FKZQ_USE_SIMD
+    constexpr int W = simd<ST>::size();
+    using VI = stdx::fixed_size_simd<IT, W>;
+    using VA = stdx::fixed_size_simd<AT, W>;
+    using VS = stdx::fixed_size_simd<ST, W>;
+    for (; i + W <= n; i += W)
+    {
+        VI v(x + i, stdx::element_aligned);
+        VA s = VA(prev + i, stdx::element_aligned) + stdx::static_simd_cast<VA>(v);
+        if (old != nullptr)
+            s -= stdx::static_simd_cast<VA>(VI(old + i, stdx::element_aligned));
+        s.copy_to(sum + i, stdx::element_aligned);
+        if (keep != nullptr)
+            v.copy_to(keep + i, stdx::element_aligned);
+        if (out != nullptr)
+            (stdx::static_simd_cast<VS>(s) * scale).copy_to(out + i, stdx::element_aligned);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        AT s = prev[i] + (AT)x[i] - (old != nullptr ? (AT)old[i] : AT(0));
+        sum[i] = s;
+        if (keep != nullptr)
+            keep[i] = x[i];
+        if (out != nullptr)
+            out[i] = (ST)s * scale;
+    }
+}
+
+// per-pixel average of the last frames pushed, optionally of their k_size x k_size box filter (reflected borders)
+// as well. the filter keeps the frames in a ring and a running sum, so a frame costs one pass that adds it and
+// subtracts the one leaving the window whatever the window length, and the spatial filter runs on the running sum
+// in the same sweep. the ring has a slot more than the window: the new frame goes to the free slot while the
+// evicted one is still read, and the running sum alternates between two buffers, so the strips of the spatial
+// pass may recompute the rows around them from the previous state without racing the strip that owns them
+template <typename IT, typename ST = float, typename AT = typename TemporalAccum<IT>::type>
+class TemporalFilter
+{
+public:
+    explicit TemporalFilter(int _frames, int _k_size = 1) : frames(_frames), k_size(_k_size)
+    {
+        assert(_frames >= 1 && _k_size >= 1);
+    }
+
+    // frames in the window now, up to the window length
+    int count() const { return (int)std::min<long>(this->pushed, this->frames); }
+
+    // forgets the frames pushed so far
+    void reset()
+    {
+        this->ring.clear();
+        this->pushed = 0;
+    }
+
+    // adds a frame, result = the average over the window including it
+    void push(const Matrix<IT> &frame, Matrix<ST> &result)
     {
-        ST *LinePD = result.ptr(j);
-        ST *LineADD = sum.ptr(pos_col[j + k_size - 1]);
-        ST *LineSUB = sum.ptr(pos_col[j]);
-        for (int i = 0; i < width_; i++)
+        assert(frame.isContinuous());
+        int height_ = frame.rows;
+        int width_ = frame.cols;
+        int cn = frame.channels;
+        if (this->ring.empty() || this->sums[0].rows != frame.rows || this->sums[0].cols != frame.cols || this->sums[0].channels != frame.channels)
         {
-            tmp = buffer_[i] + LineADD[i];
-            LinePD[i] = tmp;
-            buffer_[i] = tmp - LineSUB[i];
+            this->ring.assign(this->frames + 1, Matrix<IT>());
+            for (auto &m : this->ring)
+                m.create(height_, width_, cn);
+            for (auto &m : this->sums)
+                m.create(height_, width_, cn);
+            this->pushed = 0;
         }
+        if (result.row() != height_ || result.col() != width_ || result.channels != cn)
+            result.create(height_, width_, cn);
+
+        int slots = this->frames + 1;
+        Matrix<AT> &prev = this->sums[this->pushed & 1];
+        Matrix<AT> &cur = this->sums[(this->pushed & 1) ^ 1];
+        // a floating-point sum drifts by a rounding error per frame, it is rebuilt from the window now and then
+        if (std::is_floating_point_v<AT> && this->pushed >= this->frames && this->pushed % FKZQ_TEMPORAL_RESYNC == 0)
+            this->resum(prev);
+        const Matrix<IT> *old = this->pushed >= this->frames ? &this->ring[(this->pushed - this->frames) % slots] : nullptr;
+        Matrix<IT> &keep = this->ring[this->pushed % slots];
+        int count = (int)std::min<long>(this->pushed + 1, this->frames);
+        if (this->k_size <= 1)
+            this->step(frame, prev, old, keep, cur, result, (ST)(1.0 / count));
+        else
+            this->stepBox(frame, prev, old, keep, cur, result, count);
+        ++this->pushed;
     }
-    result *= ks;
-    free(pos_row);
-    free(pos_col);
-    AlignedFree(buffer);
-    AlignedFree(data);
-    AlignedFree(diff);
-}
\ No newline at end of file
+
+private:
+    int frames, k_size;
+    std::vector<Matrix<IT>> ring; // frame f (from 0) in slot f % (frames + 1)
+    Matrix<AT> sums[2];           // the running sum after an even and an odd number of frames
+    long pushed = 0;
+
+    void resum(Matrix<AT> &sum)
+    {
+        int slots = this->frames + 1;
+        size_t n = sum.cols * sum.channels;
+        AT *sums_ = sum.data();
+        memset(sums_, 0, sum.size);
+        for (long f = this->pushed - this->frames; f < this->pushed; f++)
+        {
+            const Matrix<IT> &m = this->ring[f % slots];
+#pragma omp parallel for schedule(static) if (sum.rows * n >= FKZQ_PARALLEL_THRESHOLD)
+            for (long i = 0; i < (long)sum.rows; i++)
+            {
+                AT *s = sums_ + i * sum.step;
+                const IT *x = m.ptr(i);
+                for (size_t j = 0; j < n; j++)
+                    s[j] += (AT)x[j];
+            }
+        }
+    }
+
+    void step(const Matrix<IT> &frame, const Matrix<AT> &prev, const Matrix<IT> *old, Matrix<IT> &keep, Matrix<AT> &cur, Matrix<ST> &result, ST scale)
+    {
+        int n = frame.cols * frame.channels;
+        // the writable buffers are taken once, ptr() from the threads would detach a shared result concurrently
+        ST *out = result.data();
+        AT *c = cur.data();
+        IT *kp = keep.data();
+#pragma omp parallel for schedule(static) if (frame.rows * n >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)frame.rows; i++)
+            temporal_row(prev.ptr(i), frame.ptr(i), old != nullptr ? old->ptr(i) : nullptr, c + i * cur.step, kp + i * keep.step, out + i * result.step, scale, n);
+    }
+
+    // the strips of box_filter_s, fed with the running sum of each padded row. a strip stores the rows it owns,
+    // the rows around it are recomputed into a scratch line
+    void stepBox(const Matrix<IT> &frame, const Matrix<AT> &prev, const Matrix<IT> *old, Matrix<IT> &keep, Matrix<AT> &cur, Matrix<ST> &result, int count)
+    {
+        int width_ = frame.cols;
+        int height_ = frame.rows;
+        int cn = frame.channels;
+        int k = this->k_size / 2;
+        int k_size = 2 * k + 1;
+        ST ks = (ST)(1.0 / ((double)count * k_size * k_size));
+        int width = width_ + 2 * k;
+        int *pos_row = get_pos(width_, k);
+        int *pos_col = get_pos(height_, k);
+
+        size_t line = result.step;
+        size_t strip = fkZQ::Params().box_strip[fkZQ::TypeClass(sizeof(ST))];
+        if (strip == 0)
+            strip = fkZQ::CacheSize(2) / 2 / (line * sizeof(ST));
+        strip = std::min<size_t>(std::max<size_t>(strip, std::max(16, 2 * k)), height_);
+        long strips = (long)((height_ + strip - 1) / strip);
+        int n = width_ * cn;
+        ST *out = result.data();
+        AT *c = cur.data();
+        IT *kp = keep.data();
+
+#pragma omp parallel if ((size_t)height_ * n * k_size >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            AT *sum_ = (AT *)AlignedMalloc<AT>(std::max(n, 1) * sizeof(AT), false);
+            AT *data_ = (AT *)AlignedMalloc<AT>(width * cn * sizeof(AT), false);
+            ST *diff_ = (ST *)AlignedMalloc<ST>(std::max(width_ - 1, 1) * cn * sizeof(ST), false);
+            ST *buffer_ = (ST *)AlignedMalloc<ST>(line * sizeof(ST), false);
+            ST *rows_ = (ST *)AlignedMalloc<ST>((strip + 2 * k) * line * sizeof(ST), false);
+#pragma omp for schedule(static)
+            for (long s = 0; s < strips; s++)
+            {
+                int j0 = s * strip;
+                int j1 = std::min<int>(j0 + strip, height_);
+                for (int p = j0; p < j1 + 2 * k; p++)
+                {
+                    int r = pos_col[p];
+                    // the row itself, not a reflection of it, in the rows of this strip
+                    bool own = p - k == r && r >= j0 && r < j1;
+                    AT *dst = own ? c + r * cur.step : sum_;
+                    temporal_row(prev.ptr(r), frame.ptr(r), old != nullptr ? old->ptr(r) : nullptr, dst, own ? kp + r * keep.step : (IT *)nullptr, (ST *)nullptr, ST(0), n);
+                    box_row_sum(dst, rows_ + (p - j0) * line, data_, diff_, pos_row, width_, k, cn);
+                }
+
+                memset(buffer_, 0, sizeof(ST) * n);
+                for (int j = 0; j < k_size - 1; j++)
+                {
+                    ST *LinePS = rows_ + j * line;
+                    for (int i = 0; i < n; i++)
+                        buffer_[i] += LinePS[i];
+                }
+                for (int j = j0; j < j1; j++)
+                {
+                    ST *LinePD = out + j * result.step;
+                    ST *LineADD = rows_ + (j - j0 + k_size - 1) * line;
+                    ST *LineSUB = rows_ + (j - j0) * line;
+                    for (int i = 0; i < n; i++)
+                    {
+                        ST tmp = buffer_[i] + LineADD[i];
+                        LinePD[i] = tmp * ks;
+                        buffer_[i] = tmp - LineSUB[i];
+                    }
+                }
+            }
+            AlignedFree(sum_);
+            AlignedFree(data_);
+            AlignedFree(diff_);
+            AlignedFree(buffer_);
+            AlignedFree(rows_);
+        }
+        free(pos_row);
+        free(pos_col);
+    }
+};
@@ -0,0 +1,245 @@
+#pragma once
+#include <cassert>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <omp.h>
+#include "matrix.h"
+
+namespace fkZQ
+{
+    enum ReduceTypes
+    {
+        REDUCE_SUM = 0,
+        REDUCE_AVG = 1,
+        REDUCE_MAX = 2,
+        REDUCE_MIN = 3,
+    };
+
+    // dst(i, j) = op(a(i, j), v(j)) for a 1 x cols row vector v, or op(a(i, j), v(i)) for a rows x 1 column vector,
+    // without building the repeated matrix. v has the channels of a, a column vector gives one pixel per row.
+    // like elementwise, op is called with simd<T> and with scalars for the row tails. dst may be a itself, or a copy
+    // sharing its buffer
+    template <typename T, typename Op>
+    void broadcast(Matrix<T> &dst, const Matrix<T> &a, const Matrix<T> &v, Op op)
+    {
+        bool by_row = v.rows == 1 && v.cols == a.cols;
+        assert((by_row || (v.rows == a.rows && v.cols == 1)) && v.channels == a.channels);
+        if (dst.rows != a.rows || dst.cols != a.cols || dst.channels != a.channels)
+            dst.create(a.rows, a.cols, a.channels);
+        size_t cn = a.channels, n = a.cols * cn;
+        const T *src = a.data(), *vec = v.data();
+        T *out = dst.data();
+#pragma omp parallel if (a.rows * n >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            // a multi-channel column vector is repeated over one row per thread
+            T *pattern = !by_row && cn > 1 ? (T *)AlignedMalloc<T>(n * sizeof(T), false) : nullptr;
+#pragma omp for schedule(static)
+            for (long i = 0; i < (long)a.rows; ++i)
+            {
+                const T *s = src + i * a.step;
+                T *d = out + i * dst.step;
+                size_t j = 0;
+                if (by_row || cn > 1)
+                {
+                    const T *r = vec;
+                    if (!by_row)
+                    {
+                        const T *px = vec + i * v.step;
+                        for (size_t k = 0; k < n; ++k)
+                            pattern[k] = px[k % cn];
+                        r = pattern;
+                    }
+#ifdef _FKZQ_USE_SIMD
+                    constexpr size_t W = simd<T>::size();
+                    for (; j + W <= n; j += W)
+                    {
+                        op(simd<T>(s + j, stdx::vector_aligned), simd<T>(r + j, stdx::vector_aligned)).copy_to(d + j, stdx::vector_aligned);
+                    }
+#endif
+                    for (; j < n; ++j)
+                    {
+                        d[j] = op(s[j], r[j]);
+                    }
+                }
+                else
+                {
+                    T x = vec[i * v.step];
+#ifdef _FKZQ_USE_SIMD
+                    constexpr size_t W = simd<T>::size();
+                    simd<T> xv = x;
+                    for (; j + W <= n; j += W)
+                    {
+                        op(simd<T>(s + j, stdx::vector_aligned), xv).copy_to(d + j, stdx::vector_aligned);
+                    }
+#endif
+                    for (; j < n; ++j)
+                    {
+                        d[j] = op(s[j], x);
+                    }
+                }
+            }
+            if (pattern)
+                AlignedFree(pattern);
+        }
+    }
+
+    template <typename T>
+    Matrix<T> broadcastAdd(const Matrix<T> &a, const Matrix<T> &v)
+    {
+        Matrix<T> ret;
+        broadcast(ret, a, v, [](auto x, auto y) { return x + y; });
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> broadcastSub(const Matrix<T> &a, const Matrix<T> &v)
+    {
+        Matrix<T> ret;
+        broadcast(ret, a, v, [](auto x, auto y) { return x - y; });
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> broadcastMul(const Matrix<T> &a, const Matrix<T> &v)
+    {
+        Matrix<T> ret;
+        broadcast(ret, a, v, [](auto x, auto y) { return x * y; });
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> broadcastDiv(const Matrix<T> &a, const Matrix<T> &v)
+    {
+        Matrix<T> ret;
+        broadcast(ret, a, v, [](auto x, auto y) { return x / y; });
+        return ret;
+    }
+
+#ifdef _FKZQ_USE_SIMD
+    // simd<U>::size() elements of T starting at p, converted to U
+    template <typename U, typename T>
+    inline simd<U> load_as(const T *p)
+    {
+        if constexpr (std::is_same_v<T, U>)
+            return simd<U>(p, stdx::element_aligned);
+        else
+            return stdx::static_simd_cast<simd<U>>(stdx::fixed_size_simd<T, simd<U>::size()>(p, stdx::element_aligned));
+    }
+#endif
+
+    // acc[0:n] = op(acc, row) for the reduction rtype, the row converted to the accumulator type U
+    template <typename U, typename T>
+    inline void reduce_row(U *acc, const T *row, size_t n, int rtype)
+    {
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<U>::size();
+        for (; j + W <= n; j += W)
+        {
+            simd<U> a(acc + j, stdx::vector_aligned), x = load_as<U>(row + j);
+            a = rtype == REDUCE_MAX ? stdx::max(a, x) : rtype == REDUCE_MIN ? stdx::min(a, x) : simd<U>(a + x);
+            a.copy_to(acc + j, stdx::vector_aligned);
+        }
+#endif
+        for (; j < n; ++j)
+        {
+            U x = (U)row[j];
+            acc[j] = rtype == REDUCE_MAX ? std::max(acc[j], x) : rtype == REDUCE_MIN ? std::min(acc[j], x) : U(acc[j] + x);
+        }
+    }
+
+    // the rows x cols matrix collapsed to a 1 x cols row (dim 0) or a rows x 1 column (dim 1) by summing, averaging
+    // or taking the extremes of every column or row, per channel like cv::reduce. sums accumulate in U, choose a
+    // wider U for integer sources
+    template <typename T, typename U>
+    void reduce(const Matrix<T> &src, Matrix<U> &dst, int dim, int rtype)
+    {
+        assert((dim == 0 || dim == 1) && rtype >= REDUCE_SUM && rtype <= REDUCE_MIN);
+        assert(!src.empty());
+        size_t cn = src.channels, n = src.cols * cn;
+        const T *s = src.data();
+        auto mean = [](U sum, size_t count) { return std::is_integral_v<U> ? (U)std::floor(sum / (double)count + 0.5) : (U)(sum / (double)count); };
+        U init = rtype == REDUCE_MAX ? std::numeric_limits<U>::lowest() : rtype == REDUCE_MIN ? std::numeric_limits<U>::max() : U(0);
+        if (dim == 0)
+        {
+            dst.create(1, src.cols, cn);
+            U *out = dst.data();
+            // every thread folds a contiguous block of rows into its own accumulator row, the rows of the
+            // accumulators are combined at the end
+            int threads = src.rows * n >= FKZQ_PARALLEL_THRESHOLD ? std::min<int>(omp_get_max_threads(), (int)src.rows) : 1;
+            std::vector<U *> partial(threads, nullptr);
+#pragma omp parallel num_threads(threads)
+            {
+                int t = omp_get_thread_num();
+                int nt = omp_get_num_threads();
+                size_t i0 = src.rows * t / nt, i1 = src.rows * (t + 1) / nt;
+                U *acc = t == 0 ? out : (U *)AlignedMalloc<U>(n * sizeof(U), false);
+                std::fill(acc, acc + n, init);
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    reduce_row(acc, s + i * src.step, n, rtype);
+                }
+                partial[t] = acc;
+            }
+            for (int t = 1; t < threads; ++t)
+            {
+                if (partial[t] == nullptr)
+                    continue;
+                reduce_row(out, partial[t], n, rtype);
+                AlignedFree(partial[t]);
+            }
+            if (rtype == REDUCE_AVG)
+            {
+                for (size_t j = 0; j < n; ++j)
+                    out[j] = mean(out[j], src.rows);
+            }
+        }
+        else
+        {
+            dst.create(src.rows, 1, cn);
+            U *out = dst.data();
+#pragma omp parallel for schedule(static) if (src.rows * n >= FKZQ_PARALLEL_THRESHOLD)
+            for (long i = 0; i < (long)src.rows; ++i)
+            {
+                const T *row = s + i * src.step;
+                U *d = out + i * dst.step;
+                size_t j = 0;
+                U r[8];
+                std::vector<U> r_(cn > 8 ? cn : 0);
+                U *px = cn > 8 ? r_.data() : r;
+                std::fill(px, px + cn, init);
+#ifdef _FKZQ_USE_SIMD
+                // vector lanes only mix channels when cn divides the vector width
+                constexpr size_t W = simd<U>::size();
+                if (W % cn == 0 && n >= W)
+                {
+                    simd<U> a = init;
+                    for (; j + W <= n; j += W)
+                    {
+                        simd<U> x = load_as<U>(row + j);
+                        a = rtype == REDUCE_MAX ? stdx::max(a, x) : rtype == REDUCE_MIN ? stdx::min(a, x) : simd<U>(a + x);
+                    }
+                    for (size_t k = 0; k < W; ++k)
+                    {
+                        U &p = px[k % cn];
+                        p = rtype == REDUCE_MAX ? std::max(p, (U)a[k]) : rtype == REDUCE_MIN ? std::min(p, (U)a[k]) : U(p + a[k]);
+                    }
+                }
+#endif
+                for (; j < n; ++j)
+                {
+                    U &p = px[j % cn];
+                    U x = (U)row[j];
+                    p = rtype == REDUCE_MAX ? std::max(p, x) : rtype == REDUCE_MIN ? std::min(p, x) : U(p + x);
+                }
+                for (size_t c = 0; c < cn; ++c)
+                {
+                    d[c] = rtype == REDUCE_AVG ? mean(px[c], src.cols) : px[c];
+                }
+            }
+        }
+    }
+}
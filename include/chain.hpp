@@ -0,0 +1,215 @@
+#pragma once
+#include <cassert>
+#include <limits>
+#include <string>
+#include <vector>
+#include "matrix.h"
+#include "gemm.hpp"
+
+#ifndef FKZQ_CHAIN_FLOPS_PER_BYTE
+#define FKZQ_CHAIN_FLOPS_PER_BYTE 4 // flops one byte of memory traffic is worth when planning a chain, about the machine balance
+#endif
+
+namespace fkZQ
+{
+    // order of evaluation of a matrix chain: matrix i is dims[i] x dims[i + 1], and the product of matrices [i, j] is
+    // split after matrix split[i * n + j]
+    struct ChainPlan
+    {
+        size_t n = 0;
+        std::vector<size_t> split;
+        double cost = 0;  // weighted flops of the whole chain
+        double flops = 0; // of the plan, and of the left to right order for comparison
+        double flops_left_to_right = 0;
+
+        // the parenthesization, matrices named by their position: ((0 1) 2)
+        std::string str() const { return this->n == 0 ? std::string() : this->str(0, this->n - 1); }
+
+    private:
+        std::string str(size_t i, size_t j) const
+        {
+            if (i == j)
+                return std::to_string(i);
+            size_t s = this->split[i * this->n + j];
+            return "(" + this->str(i, s) + " " + this->str(s + 1, j) + ")";
+        }
+    };
+
+    // cost of a p x q by q x r product: its flops, plus the elements it reads and writes weighted by
+    // FKZQ_CHAIN_FLOPS_PER_BYTE, so a memory-bound matrix-vector product is not rated by its flops alone
+    inline double ChainProductCost(size_t p, size_t q, size_t r, size_t elem_size)
+    {
+        double flops = 2.0 * p * q * r;
+        double bytes = ((double)p * q + (double)q * r + (double)p * r) * elem_size;
+        return flops + FKZQ_CHAIN_FLOPS_PER_BYTE * bytes;
+    }
+
+    // optimal parenthesization by the O(n^3) dynamic program over sub-chains
+    inline ChainPlan plan_chain(const std::vector<size_t> &dims, size_t elem_size)
+    {
+        assert(dims.size() >= 2);
+        ChainPlan plan;
+        size_t n = dims.size() - 1;
+        plan.n = n;
+        plan.split.assign(n * n, 0);
+        std::vector<double> cost(n * n, 0), flops(n * n, 0);
+        for (size_t len = 2; len <= n; ++len)
+        {
+            for (size_t i = 0; i + len <= n; ++i)
+            {
+                size_t j = i + len - 1;
+                double best = std::numeric_limits<double>::infinity();
+                for (size_t s = i; s < j; ++s)
+                {
+                    double c = cost[i * n + s] + cost[(s + 1) * n + j] + ChainProductCost(dims[i], dims[s + 1], dims[j + 1], elem_size);
+                    if (c < best)
+                    {
+                        best = c;
+                        plan.split[i * n + j] = s;
+                        flops[i * n + j] = flops[i * n + s] + flops[(s + 1) * n + j] + 2.0 * dims[i] * dims[s + 1] * dims[j + 1];
+                    }
+                }
+                cost[i * n + j] = best;
+            }
+        }
+        plan.cost = cost[n - 1];
+        plan.flops = flops[n - 1];
+        for (size_t j = 1; j < n; ++j)
+        {
+            plan.flops_left_to_right += 2.0 * dims[0] * dims[j] * dims[j + 1];
+        }
+        return plan;
+    }
+
+    // c = a * b into c[0:a.rows, 0:b.cols] with leading dimension ldc, through the matrix-vector kernels when either
+    // side is a vector
+    template <typename T>
+    void chain_product(const Matrix<T> &a, const Matrix<T> &b, T *c, size_t ldc)
+    {
+        size_t p = a.rows, q = a.cols, r = b.cols;
+        const T *ad = a.data();
+        const T *bd = b.data();
+        if (r == 1)
+        {
+            // a column vector keeps one element per padded row, gather it first
+            T *x = (T *)AlignedMalloc<T>(q * sizeof(T), false);
+            for (size_t i = 0; i < q; ++i)
+            {
+                x[i] = bd[i * b.step];
+            }
+            gemv_n(p, q, ad, a.step, x, c, ldc);
+            AlignedFree(x);
+        }
+        else if (p == 1)
+        {
+            gemv_t(q, r, bd, b.step, ad, c);
+        }
+        else
+        {
+            gemm(p, r, q, T(1), ad, a.step, bd, b.step, false, T(0), c, ldc);
+        }
+    }
+
+    namespace detail
+    {
+        // evaluates the sub-chain [i, j] of the plan. intermediates live in a pool of buffers of the size of the
+        // largest intermediate the plan computes: a result takes a free buffer when it is computed and frees its
+        // operands right after, so a left- or right-deep plan alternates between two buffers
+        // bytes of the largest intermediate product the plan computes below [i, j], the result of [i, j] itself is
+        // not counted. only the sub-chains the plan visits matter, the ones it avoids may be far larger
+        template <typename T>
+        size_t chain_capacity(const ChainPlan &plan, const std::vector<size_t> &dims, size_t i, size_t j)
+        {
+            if (i == j)
+                return 0;
+            size_t s = plan.split[i * plan.n + j];
+            size_t ret = 0;
+            if (s > i)
+                ret = std::max(ret, dims[i] * AlignedStep<T>(dims[s + 1]) * sizeof(T));
+            if (j > s + 1)
+                ret = std::max(ret, dims[s + 1] * AlignedStep<T>(dims[j + 1]) * sizeof(T));
+            return std::max({ret, chain_capacity<T>(plan, dims, i, s), chain_capacity<T>(plan, dims, s + 1, j)});
+        }
+
+        template <typename T>
+        struct ChainEvaluator
+        {
+            const std::vector<Matrix<T>> &ms;
+            const ChainPlan &plan;
+            size_t capacity; // bytes per buffer
+            std::vector<T *> buffers;
+            std::vector<bool> busy;
+
+            ~ChainEvaluator()
+            {
+                for (T *b : this->buffers)
+                    AlignedFree(b);
+            }
+
+            int acquire()
+            {
+                for (size_t k = 0; k < this->buffers.size(); ++k)
+                {
+                    if (!this->busy[k])
+                    {
+                        this->busy[k] = true;
+                        return (int)k;
+                    }
+                }
+                this->buffers.push_back((T *)AlignedMalloc<T>(this->capacity, false));
+                this->busy.push_back(true);
+                return (int)this->buffers.size() - 1;
+            }
+
+            // product [i, j], into dst when given, otherwise into a pool buffer whose index goes to slot
+            Matrix<T> eval(size_t i, size_t j, Matrix<T> *dst, int &slot)
+            {
+                slot = -1;
+                if (i == j)
+                    return this->ms[i];
+                size_t s = this->plan.split[i * this->plan.n + j];
+                int ls, rs;
+                Matrix<T> l = this->eval(i, s, nullptr, ls);
+                Matrix<T> r = this->eval(s + 1, j, nullptr, rs);
+                Matrix<T> out;
+                if (dst == nullptr)
+                {
+                    slot = this->acquire();
+                    out = Matrix<T>::wrap(l.rows, r.cols, 1, this->buffers[slot]);
+                }
+                // dst is written in place, a copy of it would make data() detach
+                Matrix<T> &target = dst != nullptr ? *dst : out;
+                chain_product(l, r, target.data(), target.step);
+                if (ls >= 0)
+                    this->busy[ls] = false;
+                if (rs >= 0)
+                    this->busy[rs] = false;
+                return target;
+            }
+        };
+    }
+
+    // product of a chain of single-channel matrices in the order plan_chain finds cheapest, e.g.
+    // multiply_chain({a, b, c, x}) for a vector x runs right to left as three matrix-vector products
+    template <typename T>
+    Matrix<T> multiply_chain(const std::vector<Matrix<T>> &ms)
+    {
+        assert(!ms.empty());
+        std::vector<size_t> dims(1, ms[0].rows);
+        for (size_t i = 0; i < ms.size(); ++i)
+        {
+            assert(ms[i].channels == 1 && ms[i].rows == dims.back());
+            dims.push_back(ms[i].cols);
+        }
+        if (ms.size() == 1)
+            return ms[0];
+        ChainPlan plan = plan_chain(dims, sizeof(T));
+        size_t n = ms.size();
+        // the whole chain goes to ret, the pool only holds the intermediates of the plan
+        detail::ChainEvaluator<T> ev{ms, plan, detail::chain_capacity<T>(plan, dims, 0, n - 1)};
+        Matrix<T> ret(dims[0], dims[n]);
+        int slot;
+        ev.eval(0, n - 1, &ret, slot);
+        return ret;
+    }
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <cassert>
+#include <vector>
+#include "matrix.h"
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace fkZQ
+{
+    // planar <-> interleaved copies of one row of n pixels with CN channels
+    template <typename T, int CN>
+    inline void split_row(const T *src, T **dst, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int c = 0; c < CN; ++c)
+            {
+                dst[c][i] = src[i * CN + c];
+            }
+        }
+    }
+
+    template <typename T, int CN>
+    inline void merge_row(const T *const *src, T *dst, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int c = 0; c < CN; ++c)
+            {
+                dst[i * CN + c] = src[c][i];
+            }
+        }
+    }
+
+#ifdef __SSSE3__
+    // pshufb masks of the 3-channel 8-bit shuffles over 16 pixels in 3 blocks of 16 bytes.
+    // split: mask[c * 3 + r] moves the bytes of channel c found in block r to their pixel position.
+    // merge: mask[r * 3 + c] moves the bytes of channel c to their place in output block r
+    struct Shuffle3Masks
+    {
+        __m128i split[9];
+        __m128i merge[9];
+        static const Shuffle3Masks &instance()
+        {
+            static const Shuffle3Masks masks;
+            return masks;
+        }
+
+    private:
+        Shuffle3Masks()
+        {
+            alignas(16) char b[16];
+            for (int c = 0; c < 3; ++c)
+            {
+                for (int r = 0; r < 3; ++r)
+                {
+                    for (int p = 0; p < 16; ++p)
+                    {
+                        int g = 3 * p + c - 16 * r;
+                        b[p] = g >= 0 && g < 16 ? (char)g : (char)0x80;
+                    }
+                    split[c * 3 + r] = _mm_load_si128((const __m128i *)b);
+                    for (int j = 0; j < 16; ++j)
+                    {
+                        int g = 16 * r + j;
+                        b[j] = g % 3 == c ? (char)(g / 3) : (char)0x80;
+                    }
+                    merge[r * 3 + c] = _mm_load_si128((const __m128i *)b);
+                }
+            }
+        }
+    };
+
+    template <>
+    inline void split_row<unsigned char, 3>(const unsigned char *src, unsigned char **dst, size_t n)
+    {
+        const __m128i *m = Shuffle3Masks::instance().split;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + 3 * i + 16));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + 3 * i + 32));
+            for (int c = 0; c < 3; ++c)
+            {
+                __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, m[c * 3]), _mm_shuffle_epi8(b, m[c * 3 + 1])),
+                                         _mm_shuffle_epi8(d, m[c * 3 + 2]));
+                _mm_storeu_si128((__m128i *)(dst[c] + i), v);
+            }
+        }
+        for (; i < n; ++i)
+        {
+            dst[0][i] = src[3 * i];
+            dst[1][i] = src[3 * i + 1];
+            dst[2][i] = src[3 * i + 2];
+        }
+    }
+
+    template <>
+    inline void merge_row<unsigned char, 3>(const unsigned char *const *src, unsigned char *dst, size_t n)
+    {
+        const __m128i *m = Shuffle3Masks::instance().merge;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i c0 = _mm_loadu_si128((const __m128i *)(src[0] + i));
+            __m128i c1 = _mm_loadu_si128((const __m128i *)(src[1] + i));
+            __m128i c2 = _mm_loadu_si128((const __m128i *)(src[2] + i));
+            for (int r = 0; r < 3; ++r)
+            {
+                __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0, m[r * 3]), _mm_shuffle_epi8(c1, m[r * 3 + 1])),
+                                         _mm_shuffle_epi8(c2, m[r * 3 + 2]));
+                _mm_storeu_si128((__m128i *)(dst + 3 * i + 16 * r), v);
+            }
+        }
+        for (; i < n; ++i)
+        {
+            dst[3 * i] = src[0][i];
+            dst[3 * i + 1] = src[1][i];
+            dst[3 * i + 2] = src[2][i];
+        }
+    }
+
+    template <>
+    inline void split_row<unsigned char, 4>(const unsigned char *src, unsigned char **dst, size_t n)
+    {
+        // group the channels inside every 4-pixel block, then transpose the 4x4 matrix of 32-bit groups
+        const __m128i m = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i r0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * i)), m);
+            __m128i r1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), m);
+            __m128i r2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * i + 32)), m);
+            __m128i r3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * i + 48)), m);
+            __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+            __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+            __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+            __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+            _mm_storeu_si128((__m128i *)(dst[0] + i), _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128((__m128i *)(dst[1] + i), _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128((__m128i *)(dst[2] + i), _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128((__m128i *)(dst[3] + i), _mm_unpackhi_epi64(t2, t3));
+        }
+        for (; i < n; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                dst[c][i] = src[4 * i + c];
+            }
+        }
+    }
+
+    template <>
+    inline void merge_row<unsigned char, 4>(const unsigned char *const *src, unsigned char *dst, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i c0 = _mm_loadu_si128((const __m128i *)(src[0] + i));
+            __m128i c1 = _mm_loadu_si128((const __m128i *)(src[1] + i));
+            __m128i c2 = _mm_loadu_si128((const __m128i *)(src[2] + i));
+            __m128i c3 = _mm_loadu_si128((const __m128i *)(src[3] + i));
+            __m128i t0 = _mm_unpacklo_epi8(c0, c1);
+            __m128i t1 = _mm_unpackhi_epi8(c0, c1);
+            __m128i t2 = _mm_unpacklo_epi8(c2, c3);
+            __m128i t3 = _mm_unpackhi_epi8(c2, c3);
+            _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_unpacklo_epi16(t0, t2));
+            _mm_storeu_si128((__m128i *)(dst + 4 * i + 16), _mm_unpackhi_epi16(t0, t2));
+            _mm_storeu_si128((__m128i *)(dst + 4 * i + 32), _mm_unpacklo_epi16(t1, t3));
+            _mm_storeu_si128((__m128i *)(dst + 4 * i + 48), _mm_unpackhi_epi16(t1, t3));
+        }
+        for (; i < n; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                dst[4 * i + c] = src[c][i];
+            }
+        }
+    }
+#endif
+
+    template <typename T>
+    inline void split_row(const T *src, T **dst, size_t n, size_t cn)
+    {
+        switch (cn)
+        {
+        case 2:
+            split_row<T, 2>(src, dst, n);
+            break;
+        case 3:
+            split_row<T, 3>(src, dst, n);
+            break;
+        case 4:
+            split_row<T, 4>(src, dst, n);
+            break;
+        default:
+            for (size_t i = 0; i < n; ++i)
+                for (size_t c = 0; c < cn; ++c)
+                    dst[c][i] = src[i * cn + c];
+        }
+    }
+
+    template <typename T>
+    inline void merge_row(const T *const *src, T *dst, size_t n, size_t cn)
+    {
+        switch (cn)
+        {
+        case 2:
+            merge_row<T, 2>(src, dst, n);
+            break;
+        case 3:
+            merge_row<T, 3>(src, dst, n);
+            break;
+        case 4:
+            merge_row<T, 4>(src, dst, n);
+            break;
+        default:
+            for (size_t i = 0; i < n; ++i)
+                for (size_t c = 0; c < cn; ++c)
+                    dst[i * cn + c] = src[c][i];
+        }
+    }
+
+    // interleaved src -> one single-channel matrix per channel
+    template <typename T>
+    void split(const Matrix<T> &src, std::vector<Matrix<T>> &dst)
+    {
+        size_t cn = src.channels;
+        dst.resize(cn);
+        for (size_t c = 0; c < cn; ++c)
+        {
+            if (dst[c].rows != src.rows || dst[c].cols != src.cols || dst[c].channels != 1)
+                dst[c].create(src.rows, src.cols);
+        }
+        std::vector<T *> planes(cn);
+        for (size_t c = 0; c < cn; ++c)
+            planes[c] = dst[c].data();
+#pragma omp parallel for schedule(static) if (src.rows * src.cols * cn >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)src.rows; ++i)
+        {
+            T *row[8];
+            std::vector<T *> rows_(cn > 8 ? cn : 0);
+            T **d = cn > 8 ? rows_.data() : row;
+            for (size_t c = 0; c < cn; ++c)
+                d[c] = planes[c] + i * dst[c].step;
+            split_row(src.ptr(i), d, src.cols, cn);
+        }
+    }
+
+    // single-channel matrices of equal size -> one interleaved matrix
+    template <typename T>
+    void merge(const std::vector<Matrix<T>> &src, Matrix<T> &dst)
+    {
+        size_t cn = src.size();
+        assert(cn > 0);
+        size_t rows = src[0].rows, cols = src[0].cols;
+        for (size_t c = 0; c < cn; ++c)
+        {
+            assert(src[c].rows == rows && src[c].cols == cols && src[c].channels == 1);
+        }
+        if (dst.rows != rows || dst.cols != cols || dst.channels != cn)
+            dst.create(rows, cols, cn);
+        T *out = dst.data();
+#pragma omp parallel for schedule(static) if (rows * cols * cn >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)rows; ++i)
+        {
+            const T *row[8];
+            std::vector<const T *> rows_(cn > 8 ? cn : 0);
+            const T **s = cn > 8 ? rows_.data() : row;
+            for (size_t c = 0; c < cn; ++c)
+                s[c] = src[c].ptr(i);
+            merge_row(s, out + i * dst.step, cols, cn);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <bit>
+#include "matrix.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#ifndef FKZQ_PREFETCH_DISTANCE
+#define FKZQ_PREFETCH_DISTANCE 1024 // bytes the streaming kernels prefetch ahead of their loads
+#endif
+
+namespace fkZQ
+{
+    // elementwise kernels whose operands together exceed this many bytes bypass the caches with streaming stores
+    // and prefetch ahead; smaller ones use regular stores so the result stays cached for the next operation
+    inline size_t &StreamingThreshold()
+    {
+        static size_t threshold = LastLevelCacheSize();
+        return threshold;
+    }
+
+#ifdef _FKZQ_USE_SIMD
+    // non-temporal store of one aligned vector
+    template <typename T>
+    inline void stream_store(T *dst, const simd<T> &v)
+    {
+#if defined(__AVX512F__)
+        if constexpr (sizeof(simd<T>) == 64)
+        {
+            _mm512_stream_si512((__m512i *)dst, std::bit_cast<__m512i>(v));
+            return;
+        }
+#endif
+#if defined(__AVX__)
+        if constexpr (sizeof(simd<T>) == 32)
+        {
+            _mm256_stream_si256((__m256i *)dst, std::bit_cast<__m256i>(v));
+            return;
+        }
+#endif
+#if defined(__SSE2__)
+        if constexpr (sizeof(simd<T>) == 16)
+        {
+            _mm_stream_si128((__m128i *)dst, std::bit_cast<__m128i>(v));
+            return;
+        }
+#endif
+        v.copy_to(dst, stdx::vector_aligned);
+    }
+#endif
+
+    // dst(i, j) = op(src(i, j)...) for every element of rows x cols matrices sharing one aligned row step.
+    // rows are split over the threads like the first touch in AlignedMalloc. op is called with simd<T> vectors
+    // and, for the last partial vector of each row, with scalars, so the padding is never computed on (an
+    // integer division by its zeros would trap). with VectorTail op only ever sees simd<T>: the last partial
+    // vector is filled up with copies of the row's last element and only its valid lanes are stored
+    template <bool VectorTail = false, typename T, typename Op, typename... Src>
+    void elementwise(size_t rows, size_t cols, size_t step, T *dst, Op op, const Src *...src)
+    {
+        static_assert((std::is_same_v<T, Src> && ...), "operands must share the element type");
+        bool parallel = rows * cols >= FKZQ_PARALLEL_THRESHOLD;
+#ifndef _FKZQ_USE_SIMD
+#pragma omp parallel for schedule(static) if (parallel)
+        for (long i = 0; i < (long)rows; ++i)
+        {
+            size_t off = i * step;
+            for (size_t j = 0; j < cols; ++j)
+            {
+                dst[off + j] = op(src[off + j]...);
+            }
+        }
+#else
+        constexpr size_t W = simd<T>::size();
+        size_t colsv = cols / W * W;
+        bool inplace = ((dst == src) || ...);
+        bool stream = !inplace && rows * step * sizeof(T) * (sizeof...(Src) + 1) >= StreamingThreshold();
+#pragma omp parallel if (parallel)
+        {
+#pragma omp for schedule(static)
+            for (long i = 0; i < (long)rows; ++i)
+            {
+                size_t off = i * step;
+                T *d = dst + off;
+                if (stream)
+                {
+                    for (size_t j = 0; j < colsv; j += W)
+                    {
+#ifdef __SSE__
+                        (_mm_prefetch((const char *)(src + off + j) + FKZQ_PREFETCH_DISTANCE, _MM_HINT_T0), ...);
+#endif
+                        stream_store(d + j, op(simd<T>(src + off + j, stdx::vector_aligned)...));
+                    }
+                }
+                else
+                {
+                    for (size_t j = 0; j < colsv; j += W)
+                    {
+                        op(simd<T>(src + off + j, stdx::vector_aligned)...).copy_to(d + j, stdx::vector_aligned);
+                    }
+                }
+                if constexpr (VectorTail)
+                {
+                    if (colsv < cols)
+                    {
+                        size_t r = cols - colsv;
+                        auto tail = [&](const T *s)
+                        {
+                            T buf[W];
+                            for (size_t k = 0; k < W; ++k)
+                            {
+                                buf[k] = s[off + colsv + std::min(k, r - 1)];
+                            }
+                            return simd<T>(buf, stdx::element_aligned);
+                        };
+                        simd<T> v = op(tail(src)...);
+                        for (size_t k = 0; k < r; ++k)
+                        {
+                            d[colsv + k] = v[k];
+                        }
+                    }
+                }
+                else
+                {
+                    for (size_t j = colsv; j < cols; ++j)
+                    {
+                        d[j] = op(src[off + j]...);
+                    }
+                }
+            }
+#ifdef __SSE__
+            if (stream)
+            {
+                _mm_sfence();
+            }
+#endif
+        }
+#endif
+    }
+}
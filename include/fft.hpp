@@ -0,0 +1,588 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "matrix.h"
+#include "resize.hpp"
+
+#ifndef FKZQ_FFT_TILE
+#define FKZQ_FFT_TILE 256 // minimum FFT size of the convolution tiles
+#endif
+#ifndef FKZQ_FFT_CHUNK
+#define FKZQ_FFT_CHUNK 64 // columns per task of the column transforms
+#endif
+#ifndef FKZQ_CONV_DIRECT_TAPS
+#define FKZQ_CONV_DIRECT_TAPS 225 // CONV_AUTO filters kernels with at most this many taps (15x15) directly
+#endif
+
+namespace fkZQ
+{
+    enum ConvolutionMethods
+    {
+        CONV_AUTO = 0,
+        CONV_DIRECT = 1,
+        CONV_FFT = 2,
+    };
+
+    // smallest even 2^a 3^b 5^c >= n, the sizes the 2D FFT supports
+    inline size_t getOptimalDFTSize(size_t n)
+    {
+        for (size_t m = std::max<size_t>(n, 2);; ++m)
+        {
+            if (m % 2)
+                continue;
+            size_t r = m;
+            for (size_t f : {2, 3, 5})
+                while (r % f == 0)
+                    r /= f;
+            if (r == 1)
+                return m;
+        }
+    }
+
+    template <typename T>
+    struct FFTStage
+    {
+        int radix;
+        size_t m;              // points of each sub-transform left for the next stages
+        std::vector<T> wr, wi; // twiddle w^(k * p) of output k of butterfly p at (k - 1) * m + p
+    };
+
+    // mixed radix 4/2/3/5 Stockham autosort stages of an n-point complex DFT. plans are built once per size
+    // and shared by every thread
+    template <typename T>
+    struct FFTPlan
+    {
+        size_t n;
+        std::vector<FFTStage<T>> stages;
+
+        static const FFTPlan<T> &get(size_t n)
+        {
+            static std::mutex lock;
+            static std::unordered_map<size_t, std::unique_ptr<FFTPlan<T>>> plans;
+            std::lock_guard<std::mutex> guard(lock);
+            std::unique_ptr<FFTPlan<T>> &plan = plans[n];
+            if (!plan)
+            {
+                plan.reset(new FFTPlan<T>(n));
+            }
+            return *plan;
+        }
+
+    private:
+        explicit FFTPlan(size_t _n) : n(_n)
+        {
+            size_t len = n;
+            while (len > 1)
+            {
+                int r = len % 4 == 0 ? 4 : len % 2 == 0 ? 2 : len % 3 == 0 ? 3 : 5;
+                assert(len % r == 0);
+                FFTStage<T> st;
+                st.radix = r;
+                st.m = len / r;
+                st.wr.resize((r - 1) * st.m);
+                st.wi.resize((r - 1) * st.m);
+                for (int k = 1; k < r; ++k)
+                {
+                    for (size_t p = 0; p < st.m; ++p)
+                    {
+                        double a = -2 * M_PI * (double)(k * p) / (double)len;
+                        st.wr[(k - 1) * st.m + p] = (T)std::cos(a);
+                        st.wi[(k - 1) * st.m + p] = (T)std::sin(a);
+                    }
+                }
+                stages.push_back(std::move(st));
+                len /= r;
+            }
+        }
+    };
+
+    template <typename T>
+    inline void fft_load(T &v, const T *p) { v = *p; }
+    template <typename T>
+    inline void fft_store(const T &v, T *p) { *p = v; }
+#ifdef _FKZQ_USE_SIMD
+    template <typename T>
+    inline void fft_load(simd<T> &v, const T *p) { v.copy_from(p, stdx::element_aligned); }
+    template <typename T>
+    inline void fft_store(const simd<T> &v, T *p) { v.copy_to(p, stdx::element_aligned); }
+#endif
+
+    // one radix-R stage. point q + s * i of the transform is the run of B values at (q + s * i) * ld, every value of
+    // a run belongs to another independent transform, so the butterflies run with simd along the runs
+    template <typename T, int R>
+    void fft_stage(const FFTStage<T> &st, size_t s, size_t ld, size_t B, const T *xr, const T *xi, T *yr, T *yi)
+    {
+        size_t m = st.m;
+        size_t sl = s * ld;
+        T cr[R], ci[R]; // exp(-2 pi i j / R)
+        for (int j = 0; j < R; ++j)
+        {
+            cr[j] = (T)std::cos(2 * M_PI * j / R);
+            ci[j] = (T)-std::sin(2 * M_PI * j / R);
+        }
+        const T h3 = (T)(std::sqrt(3.0) / 2);
+        for (size_t p = 0; p < m; ++p)
+        {
+            T wr[R], wi[R];
+            for (int k = 1; k < R; ++k)
+            {
+                wr[k] = st.wr[(k - 1) * m + p];
+                wi[k] = st.wi[(k - 1) * m + p];
+            }
+            for (size_t q = 0; q < s; ++q)
+            {
+                const T *ar = xr + q * ld + sl * p, *ai = xi + q * ld + sl * p;
+                T *br = yr + q * ld + sl * R * p, *bi = yi + q * ld + sl * R * p;
+                auto butterfly = [&](auto zero, size_t b)
+                {
+                    using V = decltype(zero);
+                    V re[R], im[R], ore[R], oim[R];
+                    for (int j = 0; j < R; ++j)
+                    {
+                        fft_load(re[j], ar + sl * m * j + b);
+                        fft_load(im[j], ai + sl * m * j + b);
+                    }
+                    if constexpr (R == 2)
+                    {
+                        ore[0] = re[0] + re[1];
+                        oim[0] = im[0] + im[1];
+                        ore[1] = re[0] - re[1];
+                        oim[1] = im[0] - im[1];
+                    }
+                    else if constexpr (R == 4)
+                    {
+                        V apcr = re[0] + re[2], apci = im[0] + im[2];
+                        V amcr = re[0] - re[2], amci = im[0] - im[2];
+                        V bpdr = re[1] + re[3], bpdi = im[1] + im[3];
+                        V bmdr = re[1] - re[3], bmdi = im[1] - im[3];
+                        ore[0] = apcr + bpdr;
+                        oim[0] = apci + bpdi;
+                        ore[1] = amcr + bmdi;
+                        oim[1] = amci - bmdr;
+                        ore[2] = apcr - bpdr;
+                        oim[2] = apci - bpdi;
+                        ore[3] = amcr - bmdi;
+                        oim[3] = amci + bmdr;
+                    }
+                    else if constexpr (R == 3)
+                    {
+                        V t1r = re[1] + re[2], t1i = im[1] + im[2];
+                        V t2r = re[0] - T(0.5) * t1r, t2i = im[0] - T(0.5) * t1i;
+                        V t3r = h3 * (re[1] - re[2]), t3i = h3 * (im[1] - im[2]);
+                        ore[0] = re[0] + t1r;
+                        oim[0] = im[0] + t1i;
+                        ore[1] = t2r + t3i;
+                        oim[1] = t2i - t3r;
+                        ore[2] = t2r - t3i;
+                        oim[2] = t2i + t3r;
+                    }
+                    else
+                    {
+                        for (int k = 0; k < R; ++k)
+                        {
+                            ore[k] = re[0];
+                            oim[k] = im[0];
+                            for (int j = 1; j < R; ++j)
+                            {
+                                int e = (j * k) % R;
+                                ore[k] += re[j] * cr[e] - im[j] * ci[e];
+                                oim[k] += re[j] * ci[e] + im[j] * cr[e];
+                            }
+                        }
+                    }
+                    fft_store(ore[0], br + b);
+                    fft_store(oim[0], bi + b);
+                    for (int k = 1; k < R; ++k)
+                    {
+                        fft_store(V(ore[k] * wr[k] - oim[k] * wi[k]), br + sl * k + b);
+                        fft_store(V(ore[k] * wi[k] + oim[k] * wr[k]), bi + sl * k + b);
+                    }
+                };
+                size_t b = 0;
+#ifdef _FKZQ_USE_SIMD
+                constexpr size_t W = simd<T>::size();
+                for (; b + W <= B; b += W)
+                {
+                    butterfly(simd<T>(), b);
+                }
+#endif
+                for (; b < B; ++b)
+                {
+                    butterfly(T(), b);
+                }
+            }
+        }
+    }
+
+    // forward DFT of plan.n points with stride ld between points, for the B independent transforms stored next to
+    // each other at [0, B) of every point. the result replaces re/im, wr/wi are scratch of the same layout.
+    // swapping re and im (and wr and wi) gives the unscaled inverse
+    template <typename T>
+    void fft_run(const FFTPlan<T> &plan, size_t ld, size_t B, T *re, T *im, T *wr, T *wi)
+    {
+        T *xr = re, *xi = im, *yr = wr, *yi = wi;
+        size_t s = 1;
+        for (const FFTStage<T> &st : plan.stages)
+        {
+            // densely stored transforms make every q of a stage one long run
+            size_t ss = ld == B ? 1 : s;
+            size_t ll = ld == B ? s * ld : ld;
+            size_t bb = ld == B ? s * B : B;
+            switch (st.radix)
+            {
+            case 2:
+                fft_stage<T, 2>(st, ss, ll, bb, xr, xi, yr, yi);
+                break;
+            case 3:
+                fft_stage<T, 3>(st, ss, ll, bb, xr, xi, yr, yi);
+                break;
+            case 4:
+                fft_stage<T, 4>(st, ss, ll, bb, xr, xi, yr, yi);
+                break;
+            default:
+                fft_stage<T, 5>(st, ss, ll, bb, xr, xi, yr, yi);
+            }
+            std::swap(xr, yr);
+            std::swap(xi, yi);
+            s *= st.radix;
+        }
+        if (xr != re)
+        {
+            for (size_t i = 0; i < plan.n; ++i)
+            {
+                memcpy(re + i * ld, xr + i * ld, B * sizeof(T));
+                memcpy(im + i * ld, xi + i * ld, B * sizeof(T));
+            }
+        }
+    }
+
+    // 2D DFT between rows x cols real values (cols even) and the rows x (cols / 2 + 1) non-redundant half of their
+    // spectrum, kept as split real and imaginary planes. row transforms take two real rows at once as the real and
+    // imaginary part of one complex row, column transforms run with simd across the columns
+    template <typename T>
+    struct FFT2D
+    {
+        size_t rows, cols, ccols;
+        const FFTPlan<T> &rplan, &cplan;
+        std::vector<T> re, im, wr, wi;
+
+        FFT2D(size_t _rows, size_t _cols)
+            : rows(_rows), cols(_cols), ccols(_cols / 2 + 1), rplan(FFTPlan<T>::get(_cols)), cplan(FFTPlan<T>::get(_rows)),
+              re(_rows * ccols), im(_rows * ccols), wr(_rows * ccols), wi(_rows * ccols)
+        {
+            assert(cols % 2 == 0);
+        }
+
+        void columns(bool inverse, bool parallel)
+        {
+            long chunks = (long)((ccols + FKZQ_FFT_CHUNK - 1) / FKZQ_FFT_CHUNK);
+#pragma omp parallel for schedule(static) if (parallel)
+            for (long c = 0; c < chunks; ++c)
+            {
+                size_t b0 = c * FKZQ_FFT_CHUNK;
+                size_t bn = std::min<size_t>(FKZQ_FFT_CHUNK, ccols - b0);
+                if (inverse)
+                    fft_run(cplan, ccols, bn, im.data() + b0, re.data() + b0, wi.data() + b0, wr.data() + b0);
+                else
+                    fft_run(cplan, ccols, bn, re.data() + b0, im.data() + b0, wr.data() + b0, wi.data() + b0);
+            }
+        }
+
+        void forward(const T *src, size_t sstep, bool parallel)
+        {
+            long pairs = (long)((rows + 1) / 2);
+#pragma omp parallel if (parallel)
+            {
+                std::vector<T> z(4 * cols);
+                T *zr = z.data(), *zi = zr + cols, *tr = zi + cols, *ti = tr + cols;
+#pragma omp for schedule(static)
+                for (long pr = 0; pr < pairs; ++pr)
+                {
+                    size_t r0 = 2 * pr, r1 = r0 + 1;
+                    std::copy(src + r0 * sstep, src + r0 * sstep + cols, zr);
+                    if (r1 < rows)
+                        std::copy(src + r1 * sstep, src + r1 * sstep + cols, zi);
+                    else
+                        std::fill(zi, zi + cols, T(0));
+                    fft_run(rplan, 1, 1, zr, zi, tr, ti);
+                    // Z = X0 + i X1 with X0, X1 hermitian: X0 = (Z[k] + conj Z[-k]) / 2, X1 = (Z[k] - conj Z[-k]) / 2i
+                    T *s0r = re.data() + r0 * ccols, *s0i = im.data() + r0 * ccols;
+                    T *s1r = s0r + ccols, *s1i = s0i + ccols;
+                    for (size_t k = 0; k < ccols; ++k)
+                    {
+                        size_t kk = (cols - k) % cols;
+                        s0r[k] = T(0.5) * (zr[k] + zr[kk]);
+                        s0i[k] = T(0.5) * (zi[k] - zi[kk]);
+                        if (r1 < rows)
+                        {
+                            s1r[k] = T(0.5) * (zi[k] + zi[kk]);
+                            s1i[k] = T(0.5) * (zr[kk] - zr[k]);
+                        }
+                    }
+                }
+            }
+            this->columns(false, parallel);
+        }
+
+        // scaled by 1 / (rows * cols), so inverse(forward(x)) = x
+        void inverse(T *dst, size_t dstep, bool parallel)
+        {
+            this->columns(true, parallel);
+            long pairs = (long)((rows + 1) / 2);
+            T scale = T(1) / T(rows * cols);
+#pragma omp parallel if (parallel)
+            {
+                std::vector<T> z(4 * cols);
+                T *zr = z.data(), *zi = zr + cols, *tr = zi + cols, *ti = tr + cols;
+#pragma omp for schedule(static)
+                for (long pr = 0; pr < pairs; ++pr)
+                {
+                    size_t r0 = 2 * pr, r1 = r0 + 1;
+                    const T *s0r = re.data() + r0 * ccols, *s0i = im.data() + r0 * ccols;
+                    const T *s1r = s0r + ccols, *s1i = s0i + ccols;
+                    bool two = r1 < rows;
+                    for (size_t k = 0; k < cols; ++k)
+                    {
+                        // the upper half of a real row's spectrum mirrors the lower one conjugated
+                        size_t kk = k < ccols ? k : cols - k;
+                        T sign = k < ccols ? T(1) : T(-1);
+                        T x0r = s0r[kk], x0i = sign * s0i[kk];
+                        T x1r = two ? s1r[kk] : T(0), x1i = two ? sign * s1i[kk] : T(0);
+                        zr[k] = x0r - x1i;
+                        zi[k] = x0i + x1r;
+                    }
+                    fft_run(rplan, 1, 1, zi, zr, ti, tr);
+                    T *d0 = dst + r0 * dstep;
+                    for (size_t k = 0; k < cols; ++k)
+                        d0[k] = zr[k] * scale;
+                    if (two)
+                    {
+                        T *d1 = d0 + dstep;
+                        for (size_t k = 0; k < cols; ++k)
+                            d1[k] = zi[k] * scale;
+                    }
+                }
+            }
+        }
+    };
+
+    // a *= conj(b) for n split complex values
+    template <typename T>
+    inline void mul_conj(T *ar, T *ai, const T *br, const T *bi, size_t n)
+    {
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<T>::size();
+        for (; j + W <= n; j += W)
+        {
+            simd<T> xr(ar + j, stdx::element_aligned), xi(ai + j, stdx::element_aligned);
+            simd<T> yr(br + j, stdx::element_aligned), yi(bi + j, stdx::element_aligned);
+            (xr * yr + xi * yi).copy_to(ar + j, stdx::element_aligned);
+            (xi * yr - xr * yi).copy_to(ai + j, stdx::element_aligned);
+        }
+#endif
+        for (; j < n; ++j)
+        {
+            T xr = ar[j], xi = ai[j];
+            ar[j] = xr * br[j] + xi * bi[j];
+            ai[j] = xi * br[j] - xr * bi[j];
+        }
+    }
+
+    // forward real-to-complex DFT of a single-channel matrix whose rows are 2^a 3^b 5^c and whose cols are an even
+    // such number (see getOptimalDFTSize). dst is the 2-channel rows x (cols / 2 + 1) half spectrum of (re, im)
+    template <typename T>
+    void dft(const Matrix<T> &src, Matrix<T> &dst)
+    {
+        static_assert(std::is_floating_point_v<T>, "dft needs a floating point matrix");
+        assert(src.channels == 1);
+        FFT2D<T> f(src.rows, src.cols);
+        f.forward(src.data(), src.step, src.rows * src.cols >= FKZQ_PARALLEL_THRESHOLD);
+        if (dst.rows != f.rows || dst.cols != f.ccols || dst.channels != 2)
+            dst.create(f.rows, f.ccols, 2);
+        T *d = dst.data();
+        for (size_t i = 0; i < f.rows; ++i)
+        {
+            for (size_t k = 0; k < f.ccols; ++k)
+            {
+                d[i * dst.step + 2 * k] = f.re[i * f.ccols + k];
+                d[i * dst.step + 2 * k + 1] = f.im[i * f.ccols + k];
+            }
+        }
+    }
+
+    // inverse of dft back to a rows x cols real matrix, scaled by 1 / (rows * cols)
+    template <typename T>
+    void idft(const Matrix<T> &src, Matrix<T> &dst, size_t cols)
+    {
+        static_assert(std::is_floating_point_v<T>, "idft needs a floating point matrix");
+        assert(src.channels == 2 && src.cols == cols / 2 + 1);
+        FFT2D<T> f(src.rows, cols);
+        const T *s = src.data();
+        for (size_t i = 0; i < f.rows; ++i)
+        {
+            for (size_t k = 0; k < f.ccols; ++k)
+            {
+                f.re[i * f.ccols + k] = s[i * src.step + 2 * k];
+                f.im[i * f.ccols + k] = s[i * src.step + 2 * k + 1];
+            }
+        }
+        if (dst.rows != f.rows || dst.cols != cols || dst.channels != 1)
+            dst.create(f.rows, cols);
+        f.inverse(dst.data(), dst.step, f.rows * cols >= FKZQ_PARALLEL_THRESHOLD);
+    }
+
+    // p(y, x) = src(y - ay, x - ax) with reflect-101 borders, (rows + kh - 1) x (cols + kw - 1)
+    template <typename T>
+    Matrix<T> pad_reflect101(const Matrix<T> &src, size_t kh, size_t kw, size_t ay, size_t ax)
+    {
+        size_t ph = src.rows + kh - 1, pw = src.cols + kw - 1;
+        Matrix<T> padded(ph, pw);
+        T *p = padded.data();
+        const T *s = src.data();
+        std::vector<int> xs(pw);
+        for (size_t x = 0; x < pw; ++x)
+            xs[x] = reflect101((int)x - (int)ax, (int)src.cols);
+#pragma omp parallel for schedule(static) if (ph * pw >= FKZQ_PARALLEL_THRESHOLD)
+        for (long y = 0; y < (long)ph; ++y)
+        {
+            const T *row = s + reflect101((int)y - (int)ay, (int)src.rows) * src.step;
+            T *d = p + y * padded.step;
+            for (size_t x = 0; x < ax; ++x)
+                d[x] = row[xs[x]];
+            memcpy(d + ax, row, src.cols * sizeof(T));
+            for (size_t x = ax + src.cols; x < pw; ++x)
+                d[x] = row[xs[x]];
+        }
+        return padded;
+    }
+
+    // dst(y, x) = sum kernel(i, j) * padded(y + i, x + j), one simd axpy per tap along the row
+    template <typename T>
+    void correlate_direct(const Matrix<T> &padded, const Matrix<T> &kernel, Matrix<T> &dst)
+    {
+        size_t H = dst.rows, W = dst.cols, kh = kernel.rows, kw = kernel.cols;
+        const T *P = padded.data();
+        const T *K = kernel.data();
+        T *D = dst.data();
+#pragma omp parallel for schedule(static) if (H * W * kh * kw >= FKZQ_PARALLEL_THRESHOLD)
+        for (long y = 0; y < (long)H; ++y)
+        {
+            T *d = D + y * dst.step;
+            std::fill(d, d + W, T(0));
+            for (size_t i = 0; i < kh; ++i)
+            {
+                const T *prow = P + (y + i) * padded.step;
+                for (size_t j = 0; j < kw; ++j)
+                {
+                    T k = K[i * kernel.step + j];
+                    const T *p = prow + j;
+                    size_t x = 0;
+#ifdef _FKZQ_USE_SIMD
+                    constexpr size_t V = simd<T>::size();
+                    for (; x + V <= W; x += V)
+                    {
+                        simd<T> acc(d + x, stdx::vector_aligned);
+                        acc += k * simd<T>(p + x, stdx::element_aligned);
+                        acc.copy_to(d + x, stdx::vector_aligned);
+                    }
+#endif
+                    for (; x < W; ++x)
+                        d[x] += k * p[x];
+                }
+            }
+        }
+    }
+
+    // overlap-save: the output is cut into disjoint tiles, each tile reads its input block plus the kernel
+    // apron, multiplies the block spectrum with the conjugated kernel spectrum (computed once) and keeps the
+    // part of the circular correlation that did not wrap. tiles run in parallel
+    template <typename T>
+    void correlate_fft(const Matrix<T> &padded, const Matrix<T> &kernel, Matrix<T> &dst)
+    {
+        size_t H = dst.rows, W = dst.cols, kh = kernel.rows, kw = kernel.cols;
+        size_t fh = getOptimalDFTSize(std::min(H + kh - 1, std::max<size_t>(FKZQ_FFT_TILE, 4 * kh)));
+        size_t fw = getOptimalDFTSize(std::min(W + kw - 1, std::max<size_t>(FKZQ_FFT_TILE, 4 * kw)));
+        size_t th = fh - kh + 1, tw = fw - kw + 1;
+        size_t ty = (H + th - 1) / th, tx = (W + tw - 1) / tw;
+
+        FFT2D<T> kf(fh, fw);
+        {
+            std::vector<T> kbuf(fh * fw, T(0));
+            for (size_t i = 0; i < kh; ++i)
+                std::copy(kernel.ptr(i), kernel.ptr(i) + kw, kbuf.data() + i * fw);
+            kf.forward(kbuf.data(), fw, true);
+        }
+        const T *P = padded.data();
+        T *D = dst.data();
+        size_t ph = padded.rows, pw = padded.cols;
+#pragma omp parallel if (ty * tx > 1)
+        {
+            FFT2D<T> f(fh, fw);
+            std::vector<T> buf(fh * fw);
+#pragma omp for schedule(dynamic)
+            for (long t = 0; t < (long)(ty * tx); ++t)
+            {
+                size_t y0 = (t / tx) * th, x0 = (t % tx) * tw;
+                for (size_t i = 0; i < fh; ++i)
+                {
+                    T *b = buf.data() + i * fw;
+                    size_t n = y0 + i < ph ? std::min(fw, pw - x0) : 0;
+                    if (n)
+                        std::copy(P + (y0 + i) * padded.step + x0, P + (y0 + i) * padded.step + x0 + n, b);
+                    std::fill(b + n, b + fw, T(0));
+                }
+                f.forward(buf.data(), fw, false);
+                mul_conj(f.re.data(), f.im.data(), kf.re.data(), kf.im.data(), f.re.size());
+                f.inverse(buf.data(), fw, false);
+                size_t oh = std::min(th, H - y0), ow = std::min(tw, W - x0);
+                for (size_t i = 0; i < oh; ++i)
+                    std::copy(buf.data() + i * fw, buf.data() + i * fw + ow, D + (y0 + i) * dst.step + x0);
+            }
+        }
+    }
+
+    template <typename T>
+    void correlate_anchor(const Matrix<T> &src, const Matrix<T> &kernel, Matrix<T> &dst, size_t ay, size_t ax, int method)
+    {
+        static_assert(std::is_floating_point_v<T>, "convolution needs a floating point matrix");
+        assert(src.channels == 1 && kernel.channels == 1);
+        Matrix<T> padded = pad_reflect101(src, kernel.rows, kernel.cols, ay, ax);
+        if (dst.rows != src.rows || dst.cols != src.cols || dst.channels != 1)
+            dst.create(src.rows, src.cols);
+        if (method == CONV_AUTO)
+            method = kernel.rows * kernel.cols <= FKZQ_CONV_DIRECT_TAPS ? CONV_DIRECT : CONV_FFT;
+        if (method == CONV_DIRECT)
+            correlate_direct(padded, kernel, dst);
+        else
+            correlate_fft(padded, kernel, dst);
+    }
+
+    // dst(y, x) = sum kernel(i, j) * src(y + i - kernel.rows / 2, x + j - kernel.cols / 2) with reflect-101 borders,
+    // what cv::filter2D computes. CONV_AUTO runs kernels of up to FKZQ_CONV_DIRECT_TAPS taps directly and larger
+    // ones through the FFT
+    template <typename T>
+    void correlate(const Matrix<T> &src, const Matrix<T> &kernel, Matrix<T> &dst, int method = CONV_AUTO)
+    {
+        correlate_anchor(src, kernel, dst, kernel.rows / 2, kernel.cols / 2, method);
+    }
+
+    // dst(y, x) = sum kernel(i, j) * src(y - i + kernel.rows / 2, x - j + kernel.cols / 2), the correlation with the
+    // flipped kernel
+    template <typename T>
+    void convolve(const Matrix<T> &src, const Matrix<T> &kernel, Matrix<T> &dst, int method = CONV_AUTO)
+    {
+        size_t kh = kernel.rows, kw = kernel.cols;
+        Matrix<T> flipped(kh, kw);
+        for (size_t i = 0; i < kh; ++i)
+            for (size_t j = 0; j < kw; ++j)
+                flipped.at(i, j) = kernel(kh - 1 - i, kw - 1 - j);
+        correlate_anchor(src, flipped, dst, kh - 1 - kh / 2, kw - 1 - kw / 2, method);
+    }
+}
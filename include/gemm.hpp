@@ -0,0 +1,888 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+#include "matrix.h"
+
+namespace fkZQ
+{
+    // y[i * incy] = sum_j a[i * lda + j] * x[j], a is m x n, x is contiguous
+    template <typename T>
+    void gemv_n(size_t m, size_t n, const T *a, size_t lda, const T *x, T *y, size_t incy)
+    {
+        long blocks = (long)((m + 3) / 4);
+#pragma omp parallel for schedule(static) if (m * n >= FKZQ_PARALLEL_THRESHOLD)
+        for (long blk = 0; blk < blocks; ++blk)
+        {
+            size_t i0 = blk * 4;
+            size_t i1 = std::min(i0 + 4, m);
+#ifndef _FKZQ_USE_SIMD
+            for (size_t i = i0; i < i1; ++i)
+            {
+                const T *ai = a + i * lda;
+                T sum = 0;
+                for (size_t j = 0; j < n; ++j)
+                {
+                    sum += ai[j] * x[j];
+                }
+                y[i * incy] = sum;
+            }
+#else
+            constexpr size_t W = simd<T>::size();
+            size_t nv = n / W * W;
+            if (i1 - i0 == 4)
+            {
+                // four rows share every load of x
+                const T *a0 = a + i0 * lda;
+                const T *a1 = a0 + lda;
+                const T *a2 = a1 + lda;
+                const T *a3 = a2 + lda;
+                simd<T> s0(0), s1(0), s2(0), s3(0);
+                for (size_t j = 0; j < nv; j += W)
+                {
+                    simd<T> xv(x + j, stdx::element_aligned);
+                    s0 += simd<T>(a0 + j, stdx::element_aligned) * xv;
+                    s1 += simd<T>(a1 + j, stdx::element_aligned) * xv;
+                    s2 += simd<T>(a2 + j, stdx::element_aligned) * xv;
+                    s3 += simd<T>(a3 + j, stdx::element_aligned) * xv;
+                }
+                T r0 = stdx::reduce(s0), r1 = stdx::reduce(s1), r2 = stdx::reduce(s2), r3 = stdx::reduce(s3);
+                for (size_t j = nv; j < n; ++j)
+                {
+                    r0 += a0[j] * x[j];
+                    r1 += a1[j] * x[j];
+                    r2 += a2[j] * x[j];
+                    r3 += a3[j] * x[j];
+                }
+                y[i0 * incy] = r0;
+                y[(i0 + 1) * incy] = r1;
+                y[(i0 + 2) * incy] = r2;
+                y[(i0 + 3) * incy] = r3;
+            }
+            else
+            {
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    const T *ai = a + i * lda;
+                    simd<T> s(0);
+                    for (size_t j = 0; j < nv; j += W)
+                    {
+                        s += simd<T>(ai + j, stdx::element_aligned) * simd<T>(x + j, stdx::element_aligned);
+                    }
+                    T r = stdx::reduce(s);
+                    for (size_t j = nv; j < n; ++j)
+                    {
+                        r += ai[j] * x[j];
+                    }
+                    y[i * incy] = r;
+                }
+            }
+#endif
+        }
+    }
+
+    // y[j] += sum_{i in [i0, i1)} x[i] * a[i * lda + j] for j in [j0, j1)
+    template <typename T>
+    inline void gemv_t_block(size_t i0, size_t i1, size_t j0, size_t j1, const T *a, size_t lda, const T *x, T *y)
+    {
+#ifndef _FKZQ_USE_SIMD
+        for (size_t i = i0; i < i1; ++i)
+        {
+            const T *ai = a + i * lda;
+            for (size_t j = j0; j < j1; ++j)
+            {
+                y[j] += x[i] * ai[j];
+            }
+        }
+#else
+        constexpr size_t W = simd<T>::size();
+        size_t jv = j0 + (j1 - j0) / W * W;
+        size_t i = i0;
+        for (; i + 4 <= i1; i += 4)
+        {
+            // four rows per pass over y halve the traffic on the accumulator
+            const T *a0 = a + i * lda;
+            const T *a1 = a0 + lda;
+            const T *a2 = a1 + lda;
+            const T *a3 = a2 + lda;
+            simd<T> x0(x[i]), x1(x[i + 1]), x2(x[i + 2]), x3(x[i + 3]);
+            for (size_t j = j0; j < jv; j += W)
+            {
+                simd<T> acc(y + j, stdx::element_aligned);
+                acc += x0 * simd<T>(a0 + j, stdx::element_aligned) + x1 * simd<T>(a1 + j, stdx::element_aligned);
+                acc += x2 * simd<T>(a2 + j, stdx::element_aligned) + x3 * simd<T>(a3 + j, stdx::element_aligned);
+                acc.copy_to(y + j, stdx::element_aligned);
+            }
+            for (size_t j = jv; j < j1; ++j)
+            {
+                y[j] += x[i] * a0[j] + x[i + 1] * a1[j] + x[i + 2] * a2[j] + x[i + 3] * a3[j];
+            }
+        }
+        for (; i < i1; ++i)
+        {
+            const T *ai = a + i * lda;
+            simd<T> xi(x[i]);
+            for (size_t j = j0; j < jv; j += W)
+            {
+                simd<T> acc(y + j, stdx::element_aligned);
+                acc += xi * simd<T>(ai + j, stdx::element_aligned);
+                acc.copy_to(y + j, stdx::element_aligned);
+            }
+            for (size_t j = jv; j < j1; ++j)
+            {
+                y[j] += x[i] * ai[j];
+            }
+        }
+#endif
+    }
+
+    // y[j] = sum_i a[i * lda + j] * x[i], a is m x n, x and y are contiguous, no transposed copy of a is made
+    template <typename T>
+    void gemv_t(size_t m, size_t n, const T *a, size_t lda, const T *x, T *y)
+    {
+        std::fill(y, y + n, T(0));
+        int threads = (m * n >= FKZQ_PARALLEL_THRESHOLD) ? omp_get_max_threads() : 1;
+        constexpr size_t CB = 1024; // columns per task, a multiple of every simd width
+        long cblocks = (long)((n + CB - 1) / CB);
+        if (threads == 1 || cblocks >= threads)
+        {
+            // split columns, every thread owns its slice of y
+#pragma omp parallel for schedule(static) if (threads > 1)
+            for (long cb = 0; cb < cblocks; ++cb)
+            {
+                gemv_t_block(0, m, cb * CB, std::min((cb + 1) * CB, n), a, lda, x, y);
+            }
+            return;
+        }
+        // few columns: split rows into per-thread partial sums and reduce them
+        std::vector<T> partial(threads * n, T(0));
+#pragma omp parallel num_threads(threads)
+        {
+            int t = omp_get_thread_num();
+            int nt = omp_get_num_threads();
+            size_t i0 = m * t / nt;
+            size_t i1 = m * (t + 1) / nt;
+            gemv_t_block(i0, i1, 0, n, a, lda, x, partial.data() + t * n);
+        }
+        for (int t = 0; t < threads; ++t)
+        {
+            const T *p = partial.data() + t * n;
+            for (size_t j = 0; j < n; ++j)
+            {
+                y[j] += p[j];
+            }
+        }
+    }
+
+    template <typename T>
+    struct GemmTile
+    {
+        static constexpr size_t MR = 4;
+#ifndef _FKZQ_USE_SIMD
+        static constexpr size_t NR = 4;
+#else
+        static constexpr size_t NR = 2 * simd<T>::size();
+#endif
+    };
+
+    // copies a[0:mc, 0:kc] into slivers of MR rows, column by column, padding the last sliver with zeros
+    template <typename T>
+    void gemm_pack_a(size_t mc, size_t kc, const T *a, size_t lda, T *ap)
+    {
+        constexpr size_t MR = GemmTile<T>::MR;
+        for (size_t i = 0; i < mc; i += MR)
+        {
+            size_t mr = std::min(MR, mc - i);
+            for (size_t p = 0; p < kc; ++p)
+            {
+                size_t r = 0;
+                for (; r < mr; ++r)
+                {
+                    ap[r] = a[(i + r) * lda + p];
+                }
+                for (; r < MR; ++r)
+                {
+                    ap[r] = 0;
+                }
+                ap += MR;
+            }
+        }
+    }
+
+    // copies the kc x nc panel of b (stored n x k when trans) into slivers of NR columns, row by row
+    template <typename T>
+    void gemm_pack_b(size_t kc, size_t j0, size_t j1, const T *b, size_t ldb, bool trans, T *bp)
+    {
+        constexpr size_t NR = GemmTile<T>::NR;
+        for (size_t j = j0; j < j1; j += NR)
+        {
+            size_t nr = std::min(NR, j1 - j);
+            for (size_t p = 0; p < kc; ++p)
+            {
+                size_t c = 0;
+                if (trans)
+                {
+                    for (; c < nr; ++c)
+                    {
+                        bp[c] = b[(j + c) * ldb + p];
+                    }
+                }
+                else
+                {
+                    const T *bj = b + p * ldb + j;
+                    for (; c < nr; ++c)
+                    {
+                        bp[c] = bj[c];
+                    }
+                }
+                for (; c < NR; ++c)
+                {
+                    bp[c] = 0;
+                }
+                bp += NR;
+            }
+        }
+    }
+
+    // c[0:mr, 0:nr] += alpha * ap * bp over one MR x NR tile
+    template <typename T>
+    inline void gemm_micro(size_t kc, const T *ap, const T *bp, T alpha, T *c, size_t ldc, size_t mr, size_t nr)
+    {
+        constexpr size_t MR = GemmTile<T>::MR;
+        constexpr size_t NR = GemmTile<T>::NR;
+#ifndef _FKZQ_USE_SIMD
+        T acc[MR][NR] = {};
+        for (size_t p = 0; p < kc; ++p)
+        {
+            for (size_t r = 0; r < MR; ++r)
+            {
+                for (size_t q = 0; q < NR; ++q)
+                {
+                    acc[r][q] += ap[r] * bp[q];
+                }
+            }
+            ap += MR;
+            bp += NR;
+        }
+        for (size_t r = 0; r < mr; ++r)
+        {
+            for (size_t q = 0; q < nr; ++q)
+            {
+                c[r * ldc + q] += alpha * acc[r][q];
+            }
+        }
+#else
+        constexpr size_t W = simd<T>::size();
+        simd<T> c00(0), c01(0), c10(0), c11(0), c20(0), c21(0), c30(0), c31(0);
+        for (size_t p = 0; p < kc; ++p)
+        {
+            simd<T> b0(bp, stdx::vector_aligned);
+            simd<T> b1(bp + W, stdx::vector_aligned);
+            simd<T> a0(ap[0]), a1(ap[1]), a2(ap[2]), a3(ap[3]);
+            c00 += a0 * b0;
+            c01 += a0 * b1;
+            c10 += a1 * b0;
+            c11 += a1 * b1;
+            c20 += a2 * b0;
+            c21 += a2 * b1;
+            c30 += a3 * b0;
+            c31 += a3 * b1;
+            ap += MR;
+            bp += NR;
+        }
+        simd<T> va(alpha);
+        if (mr == MR && nr == NR)
+        {
+            simd<T> *acc[MR][2] = {{&c00, &c01}, {&c10, &c11}, {&c20, &c21}, {&c30, &c31}};
+            for (size_t r = 0; r < MR; ++r)
+            {
+                T *cr = c + r * ldc;
+                simd<T> d0(cr, stdx::element_aligned);
+                simd<T> d1(cr + W, stdx::element_aligned);
+                d0 += va * *acc[r][0];
+                d1 += va * *acc[r][1];
+                d0.copy_to(cr, stdx::element_aligned);
+                d1.copy_to(cr + W, stdx::element_aligned);
+            }
+        }
+        else
+        {
+            alignas(sizeof(simd<T>)) T tmp[MR][NR];
+            (va * c00).copy_to(tmp[0], stdx::vector_aligned);
+            (va * c01).copy_to(tmp[0] + W, stdx::vector_aligned);
+            (va * c10).copy_to(tmp[1], stdx::vector_aligned);
+            (va * c11).copy_to(tmp[1] + W, stdx::vector_aligned);
+            (va * c20).copy_to(tmp[2], stdx::vector_aligned);
+            (va * c21).copy_to(tmp[2] + W, stdx::vector_aligned);
+            (va * c30).copy_to(tmp[3], stdx::vector_aligned);
+            (va * c31).copy_to(tmp[3] + W, stdx::vector_aligned);
+            for (size_t r = 0; r < mr; ++r)
+            {
+                for (size_t q = 0; q < nr; ++q)
+                {
+                    c[r * ldc + q] += tmp[r][q];
+                }
+            }
+        }
+#endif
+    }
+
+    // c[0:mc, j0:j1] += alpha * packed a block * packed b panel
+    template <typename T>
+    void gemm_macro(size_t mc, size_t j0, size_t j1, size_t kc, const T *ap, const T *bp, T alpha, T *c, size_t ldc)
+    {
+        constexpr size_t MR = GemmTile<T>::MR;
+        constexpr size_t NR = GemmTile<T>::NR;
+        for (size_t j = j0; j < j1; j += NR)
+        {
+            size_t nr = std::min(NR, j1 - j);
+            const T *bs = bp + (j - j0) * kc;
+            for (size_t i = 0; i < mc; i += MR)
+            {
+                gemm_micro(kc, ap + i * kc, bs, alpha, c + i * ldc + j, ldc, std::min(MR, mc - i), nr);
+            }
+        }
+    }
+
+    // c = alpha * a * b + beta * c, a is m x k, b is k x n (or n x k when trans_b), all row-major with leading dimensions lda, ldb, ldc
+    template <typename T>
+    void gemm(size_t m, size_t n, size_t k, T alpha, const T *a, size_t lda, const T *b, size_t ldb, bool trans_b, T beta, T *c, size_t ldc)
+    {
+        if (m == 0 || n == 0)
+        {
+            return;
+        }
+        bool parallel = m * n * k >= FKZQ_PARALLEL_THRESHOLD;
+        if (beta != T(1))
+        {
+#pragma omp parallel for schedule(static) if (parallel)
+            for (long i = 0; i < (long)m; ++i)
+            {
+                T *ci = c + i * ldc;
+                for (size_t j = 0; j < n; ++j)
+                {
+                    ci[j] = beta == T(0) ? T(0) : beta * ci[j];
+                }
+            }
+        }
+        if (k == 0 || alpha == T(0))
+        {
+            return;
+        }
+        constexpr size_t MR = GemmTile<T>::MR;
+        constexpr size_t NR = GemmTile<T>::NR;
+        // inside an active parallel region (a Strassen task) the nested region gets one thread, size the blocks for it
+        int threads = parallel && omp_get_active_level() < omp_get_max_active_levels() ? omp_get_max_threads() : 1;
+        const GemmBlocks &blocks = Params().gemmBlocks<T>(m, n, k);
+        // shrink the row blocks so that every thread gets one when m is small
+        size_t mc = std::min<size_t>(blocks.mc, (m + threads - 1) / threads);
+        mc = std::max(MR, (mc + MR - 1) / MR * MR);
+        size_t kcmax = std::min<size_t>(std::max<size_t>(blocks.kc, 1), k);
+        size_t ncmax = std::min<size_t>(std::max(NR, blocks.nc / NR * NR), (n + NR - 1) / NR * NR);
+        long mblocks = (long)((m + mc - 1) / mc);
+        T *bp = (T *)AlignedMalloc<T>(kcmax * ncmax * sizeof(T), false);
+#pragma omp parallel num_threads(threads)
+        {
+            T *ap = (T *)AlignedMalloc<T>(mc * kcmax * sizeof(T), false);
+            for (size_t jc = 0; jc < n; jc += ncmax)
+            {
+                size_t nc = std::min(ncmax, n - jc);
+                long nslivers = (long)((nc + NR - 1) / NR);
+                for (size_t pc = 0; pc < k; pc += kcmax)
+                {
+                    size_t kc = std::min(kcmax, k - pc);
+                    const T *bpanel = trans_b ? b + jc * ldb + pc : b + pc * ldb + jc;
+#pragma omp for schedule(static)
+                    for (long s = 0; s < nslivers; ++s)
+                    {
+                        size_t j0 = s * NR;
+                        gemm_pack_b(kc, j0, std::min(j0 + NR, nc), bpanel, ldb, trans_b, bp + j0 * kc);
+                    }
+#pragma omp for schedule(static)
+                    for (long blk = 0; blk < mblocks; ++blk)
+                    {
+                        size_t ic = blk * mc;
+                        size_t mcur = std::min(mc, m - ic);
+                        gemm_pack_a(mcur, kc, a + ic * lda + pc, lda, ap);
+                        gemm_macro(mcur, 0, nc, kc, ap, bp, alpha, c + ic * ldc + jc, ldc);
+                    }
+                }
+            }
+            AlignedFree(ap);
+        }
+        AlignedFree(bp);
+    }
+
+    enum TriangleTypes
+    {
+        TRIANGLE_UPPER = 0, // elements with column >= row
+        TRIANGLE_LOWER = 1,
+    };
+
+    // packs rows [i0, i1) of op(a) - shift over kc columns into slivers of R rows, column by column, padding the last
+    // sliver with zeros. op(a) = a, or a^T (a stored k x n) when trans. a points at the first packed column of op(a)
+    template <size_t R, typename T>
+    void syrk_pack(size_t kc, size_t i0, size_t i1, const T *a, size_t lda, bool trans, const T *shift, T *out)
+    {
+        for (size_t i = i0; i < i1; i += R)
+        {
+            size_t r = std::min(R, i1 - i);
+            T s[R] = {};
+            for (size_t q = 0; shift != nullptr && q < r; ++q)
+            {
+                s[q] = shift[i + q];
+            }
+            for (size_t p = 0; p < kc; ++p)
+            {
+                size_t q = 0;
+                if (trans)
+                {
+                    const T *ap = a + p * lda + i;
+                    for (; q < r; ++q)
+                    {
+                        out[q] = ap[q] - s[q];
+                    }
+                }
+                else
+                {
+                    for (; q < r; ++q)
+                    {
+                        out[q] = a[(i + q) * lda + p] - s[q];
+                    }
+                }
+                for (; q < R; ++q)
+                {
+                    out[q] = 0;
+                }
+                out += R;
+            }
+        }
+    }
+
+    // gemm_macro restricted to one triangle: rows [i0, i0 + mc) and columns [j0, j0 + nc) of c give the position of the
+    // block in the symmetric result, tiles outside the triangle are skipped and tiles across the diagonal are masked
+    template <typename T>
+    void syrk_macro(size_t mc, size_t i0, size_t nc, size_t j0, size_t kc, const T *ap, const T *bp, T alpha, T *c, size_t ldc, bool upper)
+    {
+        constexpr size_t MR = GemmTile<T>::MR;
+        constexpr size_t NR = GemmTile<T>::NR;
+        for (size_t j = 0; j < nc; j += NR)
+        {
+            size_t nr = std::min(NR, nc - j);
+            const T *bs = bp + j * kc;
+            for (size_t i = 0; i < mc; i += MR)
+            {
+                size_t mr = std::min(MR, mc - i);
+                size_t gi = i0 + i, gj = j0 + j;
+                if (upper ? gj + nr <= gi : gj > gi + mr - 1)
+                {
+                    continue;
+                }
+                T *ct = c + i * ldc + j;
+                if (upper ? gj >= gi + mr - 1 : gj + nr - 1 <= gi)
+                {
+                    gemm_micro(kc, ap + i * kc, bs, alpha, ct, ldc, mr, nr);
+                    continue;
+                }
+                alignas(64) T tmp[MR * NR] = {};
+                gemm_micro(kc, ap + i * kc, bs, alpha, tmp, NR, MR, NR);
+                for (size_t r = 0; r < mr; ++r)
+                {
+                    for (size_t q = 0; q < nr; ++q)
+                    {
+                        if (upper ? gj + q >= gi + r : gj + q <= gi + r)
+                        {
+                            ct[r * ldc + q] += tmp[r * NR + q];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // one triangle of c = alpha * (op(a) - shift) * (op(a) - shift)^T + beta * c, with op(a) = a (n x k), or a^T (a
+    // stored k x n) when trans. shift holds n values subtracted from the rows of op(a) while packing, nullptr for none,
+    // so a centered product costs no extra pass over a. the other triangle of c is not touched
+    template <typename T>
+    void syrk(size_t n, size_t k, T alpha, const T *a, size_t lda, bool trans, const T *shift, T beta, T *c, size_t ldc, int uplo = TRIANGLE_UPPER)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+        bool upper = uplo == TRIANGLE_UPPER;
+        bool parallel = n * n * k / 2 >= FKZQ_PARALLEL_THRESHOLD;
+        if (beta != T(1))
+        {
+#pragma omp parallel for schedule(static) if (parallel)
+            for (long i = 0; i < (long)n; ++i)
+            {
+                T *ci = c + i * ldc;
+                for (size_t j = upper ? i : 0; j < (upper ? n : i + 1); ++j)
+                {
+                    ci[j] = beta == T(0) ? T(0) : beta * ci[j];
+                }
+            }
+        }
+        if (k == 0 || alpha == T(0))
+        {
+            return;
+        }
+        constexpr size_t MR = GemmTile<T>::MR;
+        constexpr size_t NR = GemmTile<T>::NR;
+        int threads = parallel ? omp_get_max_threads() : 1;
+        const GemmBlocks &blocks = Params().gemmBlocks<T>(n, n, k);
+        // row blocks carry uneven shares of the triangle, cut them finer than gemm does and hand them out dynamically
+        size_t mc = std::min<size_t>(blocks.mc, (n + 2 * threads - 1) / (2 * threads));
+        mc = std::max(MR, (mc + MR - 1) / MR * MR);
+        size_t kcmax = std::min<size_t>(std::max<size_t>(blocks.kc, 1), k);
+        size_t ncmax = std::min<size_t>(std::max(NR, blocks.nc / NR * NR), (n + NR - 1) / NR * NR);
+        long mblocks = (long)((n + mc - 1) / mc);
+        T *bp = (T *)AlignedMalloc<T>(kcmax * ncmax * sizeof(T), false);
+#pragma omp parallel num_threads(threads)
+        {
+            T *ap = (T *)AlignedMalloc<T>(mc * kcmax * sizeof(T), false);
+            for (size_t jc = 0; jc < n; jc += ncmax)
+            {
+                size_t nc = std::min(ncmax, n - jc);
+                long nslivers = (long)((nc + NR - 1) / NR);
+                for (size_t pc = 0; pc < k; pc += kcmax)
+                {
+                    size_t kc = std::min(kcmax, k - pc);
+                    const T *apanel = trans ? a + pc * lda : a + pc;
+                    // the columns of op(a)^T are the rows of op(a), both operands come from the same packer
+#pragma omp for schedule(static)
+                    for (long s = 0; s < nslivers; ++s)
+                    {
+                        size_t j0 = s * NR;
+                        syrk_pack<NR>(kc, jc + j0, jc + std::min(j0 + NR, nc), apanel, lda, trans, shift, bp + j0 * kc);
+                    }
+#pragma omp for schedule(dynamic)
+                    for (long blk = 0; blk < mblocks; ++blk)
+                    {
+                        size_t ic = blk * mc;
+                        size_t mcur = std::min(mc, n - ic);
+                        if (upper ? ic >= jc + nc : ic + mcur <= jc)
+                        {
+                            continue;
+                        }
+                        syrk_pack<MR>(kc, ic, ic + mcur, apanel, lda, trans, shift, ap);
+                        syrk_macro(mcur, ic, nc, jc, kc, ap, bp, alpha, c + ic * ldc + jc, ldc, upper);
+                    }
+                }
+            }
+            AlignedFree(ap);
+        }
+        AlignedFree(bp);
+    }
+
+    // copies the uplo triangle of the n x n matrix c onto the other one
+    template <typename T>
+    void syrk_mirror(size_t n, T *c, size_t ldc, int uplo = TRIANGLE_UPPER)
+    {
+        constexpr size_t B = 64; // tile side, a source and a destination tile stay in L1
+        long blocks = (long)((n + B - 1) / B);
+#pragma omp parallel for schedule(dynamic) if (n * n / 2 >= FKZQ_PARALLEL_THRESHOLD)
+        for (long bi = 0; bi < blocks; ++bi)
+        {
+            // destination tiles of block row bi: the lower triangle reads the upper one and the other way round
+            size_t i0 = bi * B, i1 = std::min(n, i0 + B);
+            for (size_t j0 = 0; j0 < i1; j0 += B)
+            {
+                size_t j1 = std::min(n, j0 + B);
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    for (size_t j = j0; j < std::min(j1, i); ++j)
+                    {
+                        if (uplo == TRIANGLE_UPPER)
+                            c[i * ldc + j] = c[j * ldc + i];
+                        else
+                            c[j * ldc + i] = c[i * ldc + j];
+                    }
+                }
+            }
+        }
+    }
+
+    // c = a * b for one small matrix; a non-zero template size fixes that dimension at compile time
+    template <size_t M_, size_t N_, size_t K_, typename T>
+    inline void gemm_small(size_t m, size_t n, size_t k, const T *a, size_t lda, const T *b, size_t ldb, T *c, size_t ldc)
+    {
+        const size_t M = M_ ? M_ : m;
+        const size_t N = N_ ? N_ : n;
+        const size_t K = K_ ? K_ : k;
+        for (size_t i = 0; i < M; ++i)
+        {
+            const T *ai = a + i * lda;
+            T *ci = c + i * ldc;
+            size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+            constexpr size_t W = simd<T>::size();
+            for (; j + 4 * W <= N; j += 4 * W)
+            {
+                simd<T> c0(0), c1(0), c2(0), c3(0);
+                for (size_t p = 0; p < K; ++p)
+                {
+                    const T *bp = b + p * ldb + j;
+                    simd<T> av(ai[p]);
+                    c0 += av * simd<T>(bp, stdx::element_aligned);
+                    c1 += av * simd<T>(bp + W, stdx::element_aligned);
+                    c2 += av * simd<T>(bp + 2 * W, stdx::element_aligned);
+                    c3 += av * simd<T>(bp + 3 * W, stdx::element_aligned);
+                }
+                c0.copy_to(ci + j, stdx::element_aligned);
+                c1.copy_to(ci + j + W, stdx::element_aligned);
+                c2.copy_to(ci + j + 2 * W, stdx::element_aligned);
+                c3.copy_to(ci + j + 3 * W, stdx::element_aligned);
+            }
+            for (; j + W <= N; j += W)
+            {
+                simd<T> c0(0);
+                for (size_t p = 0; p < K; ++p)
+                {
+                    c0 += simd<T>(ai[p]) * simd<T>(b + p * ldb + j, stdx::element_aligned);
+                }
+                c0.copy_to(ci + j, stdx::element_aligned);
+            }
+#endif
+            for (; j < N; ++j)
+            {
+                T sum = 0;
+                for (size_t p = 0; p < K; ++p)
+                {
+                    sum += ai[p] * b[p * ldb + j];
+                }
+                ci[j] = sum;
+            }
+        }
+    }
+
+    // c[i] = a[i] * b[i] for i in [0, batch), the i-th matrices start at a + i * stride_a, b + i * stride_b and c + i * stride_c
+    template <typename T>
+    void gemm_batched(size_t batch, size_t m, size_t n, size_t k,
+                      const T *a, size_t lda, size_t stride_a,
+                      const T *b, size_t ldb, size_t stride_b,
+                      T *c, size_t ldc, size_t stride_c)
+    {
+        using kernel_t = void (*)(size_t, size_t, size_t, const T *, size_t, const T *, size_t, T *, size_t);
+        kernel_t kernel = gemm_small<0, 0, 0, T>;
+        if (m == n && n == k)
+        {
+            switch (m)
+            {
+            case 4:
+                kernel = gemm_small<4, 4, 4, T>;
+                break;
+            case 8:
+                kernel = gemm_small<8, 8, 8, T>;
+                break;
+            case 16:
+                kernel = gemm_small<16, 16, 16, T>;
+                break;
+            case 32:
+                kernel = gemm_small<32, 32, 32, T>;
+                break;
+            case 64:
+                kernel = gemm_small<64, 64, 64, T>;
+                break;
+            }
+        }
+#pragma omp parallel for schedule(static) if (batch * m * n * k >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)batch; ++i)
+        {
+            kernel(m, n, k, a + i * stride_a, lda, b + i * stride_b, ldb, c + i * stride_c, ldc);
+        }
+    }
+
+    // batched product over densely packed arrays of row-major matrices
+    template <typename T>
+    void gemm_batched(size_t batch, size_t m, size_t n, size_t k, const T *a, const T *b, T *c)
+    {
+        gemm_batched(batch, m, n, k, a, k, m * k, b, n, k * n, c, n, m * n);
+    }
+
+    // out[0:rows, 0:cols] = a + sign * b, leading dimensions lda, ldb, ldo
+    template <typename T>
+    void strassen_add(size_t rows, size_t cols, const T *a, size_t lda, const T *b, size_t ldb, T sign, T *out, size_t ldo)
+    {
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const T *ai = a + i * lda;
+            const T *bi = b + i * ldb;
+            T *oi = out + i * ldo;
+            size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+            constexpr size_t W = simd<T>::size();
+            size_t nv = cols / W * W;
+            for (; j < nv; j += W)
+                (simd<T>(ai + j, stdx::element_aligned) + sign * simd<T>(bi + j, stdx::element_aligned)).copy_to(oi + j, stdx::element_aligned);
+#endif
+            for (; j < cols; ++j)
+                oi[j] = ai[j] + sign * bi[j];
+        }
+    }
+
+    // the recursion splits while every side is at least the threshold, a side of 32 or less is never split
+    inline bool strassen_splits(size_t m, size_t n, size_t k, size_t threshold)
+    {
+        return threshold > 0 && std::min({m, n, k}) >= std::max<size_t>(threshold, 64);
+    }
+
+    // elements of workspace strassen_rec takes for an m x k by k x n product: the four S and four T sums, three
+    // products that have no quadrant of c to live in, and the workspace of the products below, one per product on
+    // the levels that run them as parallel tasks
+    template <typename T>
+    size_t strassen_workspace(size_t m, size_t n, size_t k, size_t threshold, int parallel_levels)
+    {
+        if (!strassen_splits(m, n, k, threshold))
+            return 0;
+        size_t hm = m / 2, hn = n / 2, hk = k / 2;
+        size_t own = 4 * hm * AlignedStep<T>(hk) + 4 * hk * AlignedStep<T>(hn) + 3 * hm * AlignedStep<T>(hn);
+        return own + (parallel_levels > 0 ? 7 : 1) * strassen_workspace<T>(hm, hn, hk, threshold, parallel_levels - 1);
+    }
+
+    // c = a * b by one level of Winograd's variant of Strassen (7 products, 15 additions) on the even part of the
+    // operands and recursion into the products. odd last rows and columns are peeled off and done by gemm, as are
+    // the leaves. the products of the first parallel_levels levels run as OpenMP tasks
+    template <typename T>
+    void strassen_rec(size_t m, size_t n, size_t k, const T *a, size_t lda, const T *b, size_t ldb, T *c, size_t ldc,
+                      size_t threshold, int parallel_levels, T *ws)
+    {
+        if (!strassen_splits(m, n, k, threshold))
+        {
+            gemm(m, n, k, T(1), a, lda, b, ldb, false, T(0), c, ldc);
+            return;
+        }
+        size_t hm = m / 2, hn = n / 2, hk = k / 2;
+        const T *a11 = a, *a12 = a + hk, *a21 = a + hm * lda, *a22 = a21 + hk;
+        const T *b11 = b, *b12 = b + hn, *b21 = b + hk * ldb, *b22 = b21 + hn;
+        T *c11 = c, *c12 = c + hn, *c21 = c + hm * ldc, *c22 = c21 + hn;
+        size_t ls = AlignedStep<T>(hk), lt = AlignedStep<T>(hn);
+        T *s1 = ws, *s2 = s1 + hm * ls, *s3 = s2 + hm * ls, *s4 = s3 + hm * ls;
+        T *t1 = s4 + hm * ls, *t2 = t1 + hk * lt, *t3 = t2 + hk * lt, *t4 = t3 + hk * lt;
+        T *p2 = t4 + hk * lt, *p6 = p2 + hm * lt, *p7 = p6 + hm * lt;
+        T *child = p7 + hm * lt;
+        size_t cw = strassen_workspace<T>(hm, hn, hk, threshold, parallel_levels - 1);
+
+        strassen_add(hm, hk, a21, lda, a22, lda, T(1), s1, ls);  // S1 = A21 + A22
+        strassen_add(hm, hk, s1, ls, a11, lda, T(-1), s2, ls);   // S2 = S1 - A11
+        strassen_add(hm, hk, a11, lda, a21, lda, T(-1), s3, ls); // S3 = A11 - A21
+        strassen_add(hm, hk, a12, lda, s2, ls, T(-1), s4, ls);   // S4 = A12 - S2
+        strassen_add(hk, hn, b12, ldb, b11, ldb, T(-1), t1, lt); // T1 = B12 - B11
+        strassen_add(hk, hn, b22, ldb, t1, lt, T(-1), t2, lt);   // T2 = B22 - T1
+        strassen_add(hk, hn, b22, ldb, b12, ldb, T(-1), t3, lt); // T3 = B22 - B12
+        strassen_add(hk, hn, t2, lt, b21, ldb, T(-1), t4, lt);   // T4 = T2 - B21
+
+        // P1, P3, P4 and P5 go to the quadrants of c, which are free until the products are combined
+        struct Product
+        {
+            const T *x;
+            size_t ldx;
+            const T *y;
+            size_t ldy;
+            T *z;
+            size_t ldz;
+        };
+        const Product products[7] = {
+            {a11, lda, b11, ldb, c11, ldc}, // P1
+            {a12, lda, b21, ldb, p2, lt},   // P2
+            {s4, ls, b22, ldb, c12, ldc},   // P3
+            {a22, lda, t4, lt, c21, ldc},   // P4
+            {s1, ls, t1, lt, c22, ldc},     // P5
+            {s2, ls, t2, lt, p6, lt},       // P6
+            {s3, ls, t3, lt, p7, lt},       // P7
+        };
+        if (parallel_levels > 0)
+        {
+            for (int i = 0; i < 7; ++i)
+            {
+                Product p = products[i];
+                T *w = child + i * cw;
+#pragma omp task firstprivate(p, w)
+                strassen_rec(hm, hn, hk, p.x, p.ldx, p.y, p.ldy, p.z, p.ldz, threshold, parallel_levels - 1, w);
+            }
+#pragma omp taskwait
+        }
+        else
+        {
+            for (const Product &p : products)
+                strassen_rec(hm, hn, hk, p.x, p.ldx, p.y, p.ldy, p.z, p.ldz, threshold, 0, child);
+        }
+
+        // C11 = P1 + P2, C12 = U4 + P3, C21 = U3 - P4, C22 = U3 + P5 with U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5
+        for (size_t i = 0; i < hm; ++i)
+        {
+            T *r11 = c11 + i * ldc, *r12 = c12 + i * ldc, *r21 = c21 + i * ldc, *r22 = c22 + i * ldc;
+            const T *r2 = p2 + i * lt, *r6 = p6 + i * lt, *r7 = p7 + i * lt;
+            size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+            constexpr size_t W = simd<T>::size();
+            size_t nv = hn / W * W;
+            for (; j < nv; j += W)
+            {
+                simd<T> v1(r11 + j, stdx::element_aligned), v3(r12 + j, stdx::element_aligned);
+                simd<T> v4(r21 + j, stdx::element_aligned), v5(r22 + j, stdx::element_aligned);
+                simd<T> u2 = v1 + simd<T>(r6 + j, stdx::element_aligned);
+                simd<T> u3 = u2 + simd<T>(r7 + j, stdx::element_aligned);
+                (v1 + simd<T>(r2 + j, stdx::element_aligned)).copy_to(r11 + j, stdx::element_aligned);
+                (u2 + v5 + v3).copy_to(r12 + j, stdx::element_aligned);
+                (u3 - v4).copy_to(r21 + j, stdx::element_aligned);
+                (u3 + v5).copy_to(r22 + j, stdx::element_aligned);
+            }
+#endif
+            for (; j < hn; ++j)
+            {
+                T v1 = r11[j], v3 = r12[j], v4 = r21[j], v5 = r22[j];
+                T u2 = v1 + r6[j];
+                T u3 = u2 + r7[j];
+                r11[j] = v1 + r2[j];
+                r12[j] = u2 + v5 + v3;
+                r21[j] = u3 - v4;
+                r22[j] = u3 + v5;
+            }
+        }
+
+        // peeling: the last column of a and row of b add a rank-one update, the last column and row of c are
+        // products of their own
+        size_t em = 2 * hm, en = 2 * hn;
+        if (k > 2 * hk)
+            gemm(em, en, (size_t)1, T(1), a + (k - 1), lda, b + (k - 1) * ldb, ldb, false, T(1), c, ldc);
+        if (n > en)
+            gemm(m, (size_t)1, k, T(1), a, lda, b + (n - 1), ldb, false, T(0), c + (n - 1), ldc);
+        if (m > em)
+            gemm((size_t)1, en, k, T(1), a + (m - 1) * lda, lda, b, ldb, false, T(0), c + (m - 1) * ldc, ldc);
+    }
+
+    // c = a * b by Strassen-Winograd down to sides below threshold, a is m x k, b is k x n, all row-major. it takes
+    // about (7/8)^levels of the multiplications of gemm, at the price of a larger rounding error that grows with the
+    // number of levels. the workspace is allocated once for the whole recursion; the first levels run their seven
+    // products as parallel tasks, as many levels as it takes to give every thread one
+    template <typename T>
+    void strassen(size_t m, size_t n, size_t k, const T *a, size_t lda, const T *b, size_t ldb, T *c, size_t ldc, size_t threshold)
+    {
+        static_assert(std::is_floating_point_v<T>, "Strassen cancels terms, integer products would overflow on the way");
+        int threads = omp_get_max_threads();
+        int parallel_levels = 0;
+        if (m * n * k >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            for (long tasks = 1; tasks < threads; tasks *= 7)
+                ++parallel_levels;
+        }
+        size_t ws = strassen_workspace<T>(m, n, k, threshold, parallel_levels);
+        T *w = ws > 0 ? (T *)AlignedMalloc<T>(ws * sizeof(T), false) : nullptr;
+        if (parallel_levels > 0)
+        {
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+            strassen_rec(m, n, k, a, lda, b, ldb, c, ldc, threshold, parallel_levels, w);
+        }
+        else
+        {
+            strassen_rec(m, n, k, a, lda, b, ldb, c, ldc, threshold, 0, w);
+        }
+        if (w != nullptr)
+            AlignedFree(w);
+    }
+}
@@ -0,0 +1,366 @@
+#pragma once
+#include <cmath>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "matrix.h"
+#include "gemm.hpp"
+#include "broadcast.hpp"
+
+#ifndef FKZQ_LINALG_BLOCK
+#define FKZQ_LINALG_BLOCK 64 // panel width of the blocked factorizations
+#endif
+
+namespace fkZQ
+{
+    enum DecompTypes
+    {
+        DECOMP_LU = 0,
+        DECOMP_CHOLESKY = 3,
+    };
+
+    // y[0:n] -= alpha * x[0:n]
+    template <typename T>
+    inline void axpy_sub(size_t n, T alpha, const T *x, T *y)
+    {
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<T>::size();
+        simd<T> va(alpha);
+        for (; j + W <= n; j += W)
+        {
+            simd<T> vy(y + j, stdx::element_aligned);
+            vy -= va * simd<T>(x + j, stdx::element_aligned);
+            vy.copy_to(y + j, stdx::element_aligned);
+        }
+#endif
+        for (; j < n; ++j)
+        {
+            y[j] -= alpha * x[j];
+        }
+    }
+
+    template <typename T>
+    inline T dot(size_t n, const T *x, const T *y)
+    {
+        T sum = 0;
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<T>::size();
+        simd<T> acc(0);
+        for (; j + W <= n; j += W)
+        {
+            acc += simd<T>(x + j, stdx::element_aligned) * simd<T>(y + j, stdx::element_aligned);
+        }
+        sum = stdx::reduce(acc);
+#endif
+        for (; j < n; ++j)
+        {
+            sum += x[j] * y[j];
+        }
+        return sum;
+    }
+
+    // in-place LU with partial pivoting, a = P * L * U with unit L below the diagonal and U on and above it.
+    // row i was swapped with row piv[i]. returns false if a is singular
+    template <typename T>
+    bool lu(Matrix<T> &a, std::vector<int> &piv)
+    {
+        size_t m = a.rows, n = a.cols, lda = a.step;
+        size_t mn = std::min(m, n);
+        T *A = a.data();
+        piv.resize(mn);
+        for (size_t j0 = 0; j0 < mn; j0 += FKZQ_LINALG_BLOCK)
+        {
+            size_t jb = std::min<size_t>(FKZQ_LINALG_BLOCK, mn - j0);
+            size_t j1 = j0 + jb;
+            // unblocked factorization of the panel a[j0:m, j0:j1]
+            for (size_t j = j0; j < j1; ++j)
+            {
+                size_t p = j;
+                T pmax = std::abs(A[j * lda + j]);
+                for (size_t i = j + 1; i < m; ++i)
+                {
+                    T v = std::abs(A[i * lda + j]);
+                    if (v > pmax)
+                    {
+                        pmax = v;
+                        p = i;
+                    }
+                }
+                piv[j] = (int)p;
+                if (pmax == T(0))
+                {
+                    return false;
+                }
+                if (p != j)
+                {
+                    std::swap_ranges(A + j * lda, A + j * lda + n, A + p * lda);
+                }
+                T inv = T(1) / A[j * lda + j];
+                const T *uj = A + j * lda + j + 1;
+#pragma omp parallel for schedule(static) if ((m - j) * jb >= FKZQ_PARALLEL_THRESHOLD)
+                for (long i = (long)j + 1; i < (long)m; ++i)
+                {
+                    T *ai = A + i * lda;
+                    ai[j] *= inv;
+                    axpy_sub(j1 - j - 1, ai[j], uj, ai + j + 1);
+                }
+            }
+            if (j1 >= n)
+            {
+                continue;
+            }
+            // a[j0:j1, j1:n] = L11^-1 * a[j0:j1, j1:n]
+            for (size_t i = j0 + 1; i < j1; ++i)
+            {
+                T *ai = A + i * lda;
+                for (size_t p = j0; p < i; ++p)
+                {
+                    axpy_sub(n - j1, ai[p], A + p * lda + j1, ai + j1);
+                }
+            }
+            // trailing update a[j1:m, j1:n] -= a[j1:m, j0:j1] * a[j0:j1, j1:n]
+            if (j1 < m)
+            {
+                gemm(m - j1, n - j1, jb, T(-1), A + j1 * lda + j0, lda, A + j0 * lda + j1, lda, false, T(1), A + j1 * lda + j1, lda);
+            }
+        }
+        return true;
+    }
+
+    // in-place Cholesky factorization a = L * L^T of a symmetric positive definite matrix, only the lower
+    // triangle of a is read and the upper one is zeroed. returns false if a is not positive definite
+    template <typename T>
+    bool cholesky(Matrix<T> &a)
+    {
+        assert(a.rows == a.cols);
+        size_t n = a.rows, lda = a.step;
+        T *A = a.data();
+        for (size_t j0 = 0; j0 < n; j0 += FKZQ_LINALG_BLOCK)
+        {
+            size_t jb = std::min<size_t>(FKZQ_LINALG_BLOCK, n - j0);
+            size_t j1 = j0 + jb;
+            // diagonal block
+            for (size_t j = j0; j < j1; ++j)
+            {
+                T *aj = A + j * lda;
+                T d = aj[j] - dot(j - j0, aj + j0, aj + j0);
+                if (!(d > T(0)))
+                {
+                    return false;
+                }
+                aj[j] = std::sqrt(d);
+                for (size_t i = j + 1; i < j1; ++i)
+                {
+                    T *ai = A + i * lda;
+                    ai[j] = (ai[j] - dot(j - j0, ai + j0, aj + j0)) / aj[j];
+                }
+            }
+            if (j1 == n)
+            {
+                break;
+            }
+            // a[j1:n, j0:j1] = a[j1:n, j0:j1] * L11^-T
+#pragma omp parallel for schedule(static) if ((n - j1) * jb * jb >= FKZQ_PARALLEL_THRESHOLD)
+            for (long i = (long)j1; i < (long)n; ++i)
+            {
+                T *ai = A + i * lda;
+                for (size_t j = j0; j < j1; ++j)
+                {
+                    const T *aj = A + j * lda;
+                    ai[j] = (ai[j] - dot(j - j0, ai + j0, aj + j0)) / aj[j];
+                }
+            }
+            // lower part of the trailing update a[j1:n, j1:n] -= a[j1:n, j0:j1] * a[j1:n, j0:j1]^T, one block row per task
+            long blocks = (long)((n - j1 + FKZQ_LINALG_BLOCK - 1) / FKZQ_LINALG_BLOCK);
+#pragma omp parallel for schedule(dynamic) if ((n - j1) * (n - j1) * jb >= FKZQ_PARALLEL_THRESHOLD)
+            for (long blk = 0; blk < blocks; ++blk)
+            {
+                size_t i0 = j1 + blk * FKZQ_LINALG_BLOCK;
+                size_t ib = std::min<size_t>(FKZQ_LINALG_BLOCK, n - i0);
+                gemm(ib, i0 + ib - j1, jb, T(-1), A + i0 * lda + j0, lda, A + j1 * lda + j0, lda, true, T(1), A + i0 * lda + j1, lda);
+            }
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::fill(A + i * lda + i + 1, A + i * lda + n, T(0));
+        }
+        return true;
+    }
+
+    // forward substitution b = L^-1 * b in place, L is the lower triangle of l (with an implicit unit diagonal if unit)
+    template <typename T>
+    void solve_lower(const Matrix<T> &l, Matrix<T> &b, bool unit = false)
+    {
+        assert(l.rows == l.cols);
+        assert(l.rows == b.rows);
+        size_t n = l.rows, nrhs = b.cols, lda = l.step, ldb = b.step;
+        const T *L = l.data();
+        T *B = b.data();
+        for (size_t i0 = 0; i0 < n; i0 += FKZQ_LINALG_BLOCK)
+        {
+            size_t i1 = std::min<size_t>(i0 + FKZQ_LINALG_BLOCK, n);
+            for (size_t i = i0; i < i1; ++i)
+            {
+                const T *li = L + i * lda;
+                T *bi = B + i * ldb;
+                for (size_t p = i0; p < i; ++p)
+                {
+                    axpy_sub(nrhs, li[p], B + p * ldb, bi);
+                }
+                if (!unit)
+                {
+                    T inv = T(1) / li[i];
+                    for (size_t j = 0; j < nrhs; ++j)
+                    {
+                        bi[j] *= inv;
+                    }
+                }
+            }
+            if (i1 < n)
+            {
+                gemm(n - i1, nrhs, i1 - i0, T(-1), L + i1 * lda + i0, lda, B + i0 * ldb, ldb, false, T(1), B + i1 * ldb, ldb);
+            }
+        }
+    }
+
+    // back substitution b = U^-1 * b in place, U is the upper triangle of u (with an implicit unit diagonal if unit)
+    template <typename T>
+    void solve_upper(const Matrix<T> &u, Matrix<T> &b, bool unit = false)
+    {
+        assert(u.rows == u.cols);
+        assert(u.rows == b.rows);
+        size_t n = u.rows, nrhs = b.cols, lda = u.step, ldb = b.step;
+        const T *U = u.data();
+        T *B = b.data();
+        size_t nblocks = (n + FKZQ_LINALG_BLOCK - 1) / FKZQ_LINALG_BLOCK;
+        for (size_t blk = nblocks; blk-- > 0;)
+        {
+            size_t i0 = blk * FKZQ_LINALG_BLOCK;
+            size_t i1 = std::min<size_t>(i0 + FKZQ_LINALG_BLOCK, n);
+            if (i1 < n)
+            {
+                gemm(i1 - i0, nrhs, n - i1, T(-1), U + i0 * lda + i1, lda, B + i1 * ldb, ldb, false, T(1), B + i0 * ldb, ldb);
+            }
+            for (size_t i = i1; i-- > i0;)
+            {
+                const T *ui = U + i * lda;
+                T *bi = B + i * ldb;
+                for (size_t p = i + 1; p < i1; ++p)
+                {
+                    axpy_sub(nrhs, ui[p], B + p * ldb, bi);
+                }
+                if (!unit)
+                {
+                    T inv = T(1) / ui[i];
+                    for (size_t j = 0; j < nrhs; ++j)
+                    {
+                        bi[j] *= inv;
+                    }
+                }
+            }
+        }
+    }
+
+    // b = A^-1 * b in place, given the output of lu
+    template <typename T>
+    void lu_solve(const Matrix<T> &lu, const std::vector<int> &piv, Matrix<T> &b)
+    {
+        T *B = b.data();
+        for (size_t i = 0; i < piv.size(); ++i)
+        {
+            if ((size_t)piv[i] != i)
+            {
+                std::swap_ranges(B + i * b.step, B + i * b.step + b.cols, B + piv[i] * b.step);
+            }
+        }
+        solve_lower(lu, b, true);
+        solve_upper(lu, b);
+    }
+
+    // b = A^-1 * b in place, given the output of cholesky
+    template <typename T>
+    void cholesky_solve(const Matrix<T> &l, Matrix<T> &b)
+    {
+        solve_lower(l, b);
+        solve_upper(l.transpose(), b);
+    }
+
+    // solves a * x = b for square a, returns false if a is singular (or not positive definite for DECOMP_CHOLESKY)
+    template <typename T>
+    bool solve(const Matrix<T> &a, const Matrix<T> &b, Matrix<T> &x, int method = DECOMP_LU)
+    {
+        assert(a.rows == a.cols);
+        assert(a.rows == b.rows);
+        Matrix<T> f = a.clone();
+        x = b.clone();
+        if (method == DECOMP_CHOLESKY)
+        {
+            if (!cholesky(f))
+            {
+                return false;
+            }
+            cholesky_solve(f, x);
+            return true;
+        }
+        std::vector<int> piv;
+        if (!lu(f, piv))
+        {
+            return false;
+        }
+        lu_solve(f, piv, x);
+        return true;
+    }
+
+    // c = alpha * op(a - delta) * op(a - delta)^T + beta * c for single-channel a, with op(x) = x, or x^T when aTa
+    // (c = a^T a, the Gram matrix of the columns). only the uplo triangle is computed, then mirrored unless mirror is
+    // false. delta is subtracted while packing: a column of a.rows values, or a row of a.cols values when aTa, empty
+    // for none. c is (re)created when it has the wrong size, which needs beta == 0
+    template <typename T>
+    void syrk(const Matrix<T> &a, Matrix<T> &c, bool aTa = false, T alpha = 1, T beta = 0, const Matrix<T> &delta = Matrix<T>(),
+              int uplo = TRIANGLE_UPPER, bool mirror = true)
+    {
+        assert(a.channels == 1);
+        size_t n = aTa ? a.cols : a.rows;
+        size_t k = aTa ? a.rows : a.cols;
+        if (c.rows != n || c.cols != n || c.channels != 1)
+        {
+            assert(beta == T(0));
+            c.create(n, n);
+        }
+        std::vector<T> shift;
+        if (!delta.empty())
+        {
+            assert(delta.channels == 1 && delta.rows * delta.cols == n && (delta.rows == 1 || delta.cols == 1));
+            // a column vector keeps one element per padded row
+            shift.resize(n);
+            const T *d = delta.data();
+            size_t inc = delta.rows == 1 ? 1 : delta.step;
+            for (size_t i = 0; i < n; ++i)
+            {
+                shift[i] = d[i * inc];
+            }
+        }
+        T *cd = c.data();
+        syrk(n, k, alpha, a.data(), a.step, aTa, shift.empty() ? nullptr : shift.data(), beta, cd, c.step, uplo);
+        if (mirror)
+        {
+            syrk_mirror(n, cd, c.step, uplo);
+        }
+    }
+
+    // covariance of samples stored one per row, or one per column when !rows_are_samples. mean gets the mean sample
+    // (a row, or a column), covar the n x n matrix sum (x - mean)(x - mean)^T / (count - 1). the data is read once for
+    // the mean and once more for the product, which centers it while packing
+    template <typename T>
+        requires std::is_floating_point_v<T>
+    void covariance(const Matrix<T> &samples, Matrix<T> &covar, Matrix<T> &mean, bool rows_are_samples = true)
+    {
+        assert(samples.channels == 1);
+        size_t count = rows_are_samples ? samples.rows : samples.cols;
+        assert(count > 1);
+        reduce(samples, mean, rows_are_samples ? 0 : 1, REDUCE_AVG);
+        syrk(samples, covar, rows_are_samples, T(1) / T(count - 1), T(0), mean);
+    }
+}
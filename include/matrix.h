@@ -5,6 +5,18 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <type_traits>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 #ifdef FKZQ_DEBUG
 #define FKZQ_NEW std::cout << "new matrix at" << __FILE__ << " " << __LINE__ << "@" << __FUNCTION__ << ", addr: " << this << std::endl;
@@ -20,50 +32,177 @@ namespace stdx = std::experimental;
 #define simd stdx::native_simd
 #endif
 
+#include "params.h"
+
+#ifndef FKZQ_HUGEPAGE_THRESHOLD
+#define FKZQ_HUGEPAGE_THRESHOLD (4 << 20) // bytes, default of HugePageThreshold()
+#endif
+#define FKZQ_HUGEPAGE_SIZE (2 << 20)
+
 namespace fkZQ
 {
     template <typename T>
     class Matrix;
 
+    // allocations of at least HugePageThreshold() bytes are 2 MB aligned, advised for transparent huge pages and
+    // zeroed by all threads with the static row partitioning of the kernels, so every page is first touched by the
+    // thread (and NUMA node) that later works on it. 0 disables the huge-page path
+    inline size_t &HugePageThreshold()
+    {
+        static size_t threshold = FKZQ_HUGEPAGE_THRESHOLD;
+        return threshold;
+    }
+    // bytes currently allocated through the huge-page path
+    inline std::atomic<size_t> &HugePageBytes()
+    {
+        static std::atomic<size_t> bytes(0);
+        return bytes;
+    }
+    // bytes of this process the kernel actually backs with huge pages (AnonHugePages), 0 where unknown
+    inline size_t HugePageResidentBytes()
+    {
+        size_t kb = 0;
+#ifdef __linux__
+        std::ifstream smaps("/proc/self/smaps_rollup");
+        std::string key;
+        while (smaps >> key)
+        {
+            if (key == "AnonHugePages:")
+            {
+                smaps >> kb;
+                break;
+            }
+            smaps.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+#endif
+        return kb * 1024;
+    }
+
+    struct HugePageRegistry
+    {
+        std::mutex lock;
+        std::unordered_map<void *, size_t> sizes;
+        static HugePageRegistry &instance()
+        {
+            static HugePageRegistry registry;
+            return registry;
+        }
+    };
+
+    inline void *RawAlignedMalloc(size_t size, size_t align)
+    {
+#ifdef _WIN32
+        return _aligned_malloc(size, align);
+#else
+        void *ptr = nullptr;
+        if (posix_memalign(&ptr, align < sizeof(void *) ? sizeof(void *) : align, size) != 0)
+        {
+            return nullptr;
+        }
+        return ptr;
+#endif
+    }
+    inline void RawAlignedFree(void *ptr)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    // 2 MB aligned allocation advised for transparent huge pages, nullptr on failure
+    inline void *HugePageMalloc(size_t size)
+    {
+        size_t bytes = (size + FKZQ_HUGEPAGE_SIZE - 1) / FKZQ_HUGEPAGE_SIZE * FKZQ_HUGEPAGE_SIZE;
+        void *ptr = RawAlignedMalloc(bytes, FKZQ_HUGEPAGE_SIZE);
+        if (ptr == nullptr)
+        {
+            return nullptr;
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+        HugePageRegistry &registry = HugePageRegistry::instance();
+        {
+            std::lock_guard<std::mutex> guard(registry.lock);
+            registry.sizes[ptr] = bytes;
+        }
+        HugePageBytes() += bytes;
+        return ptr;
+    }
+
+    inline bool UseHugePages(size_t size)
+    {
+        return HugePageThreshold() != 0 && size >= HugePageThreshold();
+    }
+
     template <typename T>
     void *AlignedMalloc(size_t size, bool zero = true)
     {
         void *ptr = nullptr;
 #ifndef _FKZQ_USE_SIMD
-        ptr = malloc(size);
+        size_t align = sizeof(T);
 #else
         size_t align = sizeof(simd<T>);
-        ptr = _aligned_malloc(size, align);
 #endif
+        size = (size + align - 1) / align * align;
+        if (UseHugePages(size) && (ptr = HugePageMalloc(size)) != nullptr)
+        {
+            // first touch in page-sized chunks spread over the threads
+            long pages = (long)((size + 4095) / 4096);
+#pragma omp parallel for schedule(static)
+            for (long p = 0; p < pages; ++p)
+            {
+                memset((char *)ptr + p * 4096, 0, std::min<size_t>(4096, size - p * 4096));
+            }
+            return ptr;
+        }
+        ptr = RawAlignedMalloc(size, align);
         if (ptr == nullptr)
         {
             std::cerr << "AlignedMalloc failed" << std::endl;
             exit(1);
         }
-        else
+        else if (zero)
         {
-#ifndef _FKZQ_USE_SIMD
             memset(ptr, 0, size);
-#else
-            memset(ptr, 0, (size + align - 1) / align * align);
-#endif
         }
         return ptr;
     }
+    // elements per row of a matrix with col elements per row, rows start on a vector boundary
+    template <typename T>
+    inline size_t AlignedStep(size_t col)
+    {
+#ifndef _FKZQ_USE_SIMD
+        return col;
+#else
+        size_t align = sizeof(simd<T>);
+        return ((col * sizeof(T) + align - 1) / align * align) / sizeof(T);
+#endif
+    }
     template <typename T>
     void *AlignedMalloc(size_t row, size_t col, size_t &step, size_t &size, bool zero = true)
     {
         void *ptr = nullptr;
 #ifndef _FKZQ_USE_SIMD
-        step = col;
-        size = row * step * sizeof(T);
-        ptr = malloc(size);
+        size_t align = sizeof(T);
 #else
         size_t align = sizeof(simd<T>);
-        step = ((col * sizeof(T) + align - 1) / align * align) / sizeof(T);
-        size = row * step * sizeof(T);
-        ptr = _aligned_malloc(size, align);
 #endif
+        step = AlignedStep<T>(col);
+        size = row * step * sizeof(T);
+        if (UseHugePages(size) && (ptr = HugePageMalloc(size)) != nullptr)
+        {
+            size_t bytes = step * sizeof(T);
+#pragma omp parallel for schedule(static)
+            for (long i = 0; i < (long)row; ++i)
+            {
+                memset((char *)ptr + i * bytes, 0, bytes);
+            }
+            return ptr;
+        }
+        ptr = RawAlignedMalloc(size, align);
         if (ptr == nullptr)
         {
             std::cerr << "AlignedMalloc failed" << std::endl;
@@ -77,23 +216,45 @@ namespace fkZQ
     }
     inline void AlignedFree(void *ptr)
     {
-#ifndef _FKZQ_USE_SIMD
-        free(ptr);
-#else
-        _aligned_free(ptr);
-#endif
+        if (ptr != nullptr && ((uintptr_t)ptr & (FKZQ_HUGEPAGE_SIZE - 1)) == 0)
+        {
+            // only 2 MB aligned blocks can come from HugePageMalloc
+            HugePageRegistry &registry = HugePageRegistry::instance();
+            std::lock_guard<std::mutex> guard(registry.lock);
+            auto it = registry.sizes.find(ptr);
+            if (it != registry.sizes.end())
+            {
+                HugePageBytes() -= it->second;
+                registry.sizes.erase(it);
+            }
+        }
+        RawAlignedFree(ptr);
     }
 
+    // elementwise static_cast to U, interleaved channels are converted as they are stored
     template <typename U, typename T>
     Matrix<U> inline toType(const Matrix<T> &mat)
     {
-        auto ptr = mat.ptr(0);
-        Matrix<U> ret(mat.rows, mat.cols);
-        for (size_t i = 0; i < mat.rows; ++i)
+        Matrix<U> ret(mat.rows, mat.cols, mat.channels);
+        size_t n = mat.cols * mat.channels;
+        const T *src = mat.data();
+        U *dst = ret.data();
+#pragma omp parallel for schedule(static) if (mat.rows * n >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)mat.rows; ++i)
         {
-            for (size_t j = 0; j < mat.cols; ++j)
+            const T *s = src + i * mat.step;
+            U *d = dst + i * ret.step;
+            size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+            constexpr size_t W = simd<U>::size();
+            for (; j + W <= n; j += W)
+            {
+                stdx::static_simd_cast<U>(stdx::fixed_size_simd<T, W>(s + j, stdx::element_aligned)).copy_to(d + j, stdx::element_aligned);
+            }
+#endif
+            for (; j < n; ++j)
             {
-                ret.at(i, j) = static_cast<U>(ptr[i * mat.step + j]);
+                d[j] = static_cast<U>(s[j]);
             }
         }
         return ret;
@@ -104,55 +265,80 @@ namespace fkZQ
     {
     private:
         T *_data;
+        T *_datastart;               // start of the allocation, differs from _data for views, nullptr for a read-only buffer
+        std::atomic<int> *_refcount; // shared by every copy of the buffer, nullptr when there is none or it is external
+        void release();
+        void detach(); // gives this matrix its own buffer if it is shared
 
     public:
         using _T = T;
         size_t rows, cols;
+        size_t channels; // interleaved elements per pixel, a row holds cols * channels elements
         size_t step, size;
         ~Matrix();
         Matrix();
         Matrix(Matrix<T> &&other);      // move constructor
-        Matrix(const Matrix<T> &other); // copy constructor
+        Matrix(const Matrix<T> &other); // copy constructor, shares the buffer until either side writes
         Matrix(size_t _rows, size_t _cols);
+        Matrix(size_t _rows, size_t _cols, size_t _channels);
         Matrix(size_t _rows, size_t _cols, const T *_data, bool aligned = true);
-        void create(size_t _rows, size_t _cols);
-        bool isContinuous();
+        // wraps an external buffer laid out like AlignedMalloc (vector aligned rows of AlignedStep<T>(cols * channels)
+        // elements) without copying or owning it: writes go to the buffer, which must outlive every copy of the matrix
+        static Matrix<T> wrap(size_t _rows, size_t _cols, size_t _channels, T *_data);
+        // the same over a buffer that must not be written (e.g. a read-only mapping): the copies share it until one of
+        // them writes, which then gets its own buffer like a shared copy does
+        static Matrix<T> wrapReadOnly(size_t _rows, size_t _cols, size_t _channels, const T *_data);
+        void create(size_t _rows, size_t _cols, size_t _channels = 1);
+        bool isContinuous() const;
+        Matrix<T> clone() const; // deep copy
+        // rows x cols x channels matrix with its own aligned step placed offset elements into this buffer,
+        // sharing the buffer like a copy does. offset must keep the rows vector aligned
+        Matrix<T> view(size_t offset, size_t rows, size_t cols, size_t channels = 1) const;
 
         void clear();
         void setZero();
 
         T *data();
+        const T *data() const;
 
-        size_t col();
-        size_t row();
-        size_t elements();
+        size_t col() const;
+        size_t row() const;
+        size_t elements() const;
 
-        T operator[](size_t index);
-        T operator()(size_t row, size_t col);
+        T operator[](size_t index) const;
+        T operator()(size_t row, size_t col) const;
 
-        T &at(size_t index) const;
-        T &at(size_t row, size_t col) const;
+        // non-const accessors copy a shared buffer before handing out a writable reference
+        T &at(size_t index);
+        T &at(size_t row, size_t col);
+        const T &at(size_t index) const;
+        const T &at(size_t row, size_t col) const;
         T *ptr(size_t row);
         T *ptr(size_t row, size_t col);
+        const T *ptr(size_t row) const;
+        const T *ptr(size_t row, size_t col) const;
 
-        bool empty();
+        bool empty() const;
 
         template <typename U>
         friend std::ostream &operator<<(std::ostream &o, const Matrix<U> &mat);
 
     private:
-        void add(Matrix<T> &ret, const Matrix<T> &other);
-        void add(Matrix<T> &ret, const T &other);
-        void sub(Matrix<T> &ret, const Matrix<T> &other);
-        void sub(Matrix<T> &ret, const T &other);
-        void multiply(Matrix<T> &ret, const Matrix<T> &other);
-        void multiply(Matrix<T> &ret, const T &other);
-        void mul(Matrix<T> &ret, const Matrix<T> &other);
-        void div(Matrix<T> &ret, const Matrix<T> &other);
-        void div(Matrix<T> &ret, const T &other);
+        void add(Matrix<T> &ret, const Matrix<T> &other) const;
+        void add(Matrix<T> &ret, const T &other) const;
+        void sub(Matrix<T> &ret, const Matrix<T> &other) const;
+        void sub(Matrix<T> &ret, const T &other) const;
+        void multiply(Matrix<T> &ret, const Matrix<T> &other) const;
+        void multiply(Matrix<T> &ret, const T &other) const;
+        void mul(Matrix<T> &ret, const Matrix<T> &other) const;
+        void div(Matrix<T> &ret, const Matrix<T> &other) const;
+        void div(Matrix<T> &ret, const T &other) const;
+        void gemv(Matrix<T> &ret, const Matrix<T> &x, bool trans) const;
 
     public:
         Matrix<T> transpose() const;
+        Matrix<T> gemv(const Matrix<T> &x, bool trans = false) const; // this * x or this^T * x for a row or column vector x
+        Matrix<T> inverse() const requires std::is_floating_point_v<T>; // empty if singular
         void operator=(const Matrix<T> &other); // copy assignment
         void operator=(Matrix<T> &&other);      // move assignment
         Matrix<T> operator+(const Matrix<T> &other);
@@ -174,13 +360,13 @@ namespace fkZQ
         template <typename U>
         friend Matrix<U> operator/(const U &other, const Matrix<U> &mat);
 
-        Matrix<T> operator+=(const Matrix<T> &other);
-        Matrix<T> operator+=(const T &other);
-        Matrix<T> operator-=(const Matrix<T> &other);
-        Matrix<T> operator-=(const T &other);
-        Matrix<T> operator*=(const Matrix<T> &other);
-        Matrix<T> operator*=(const T &other);
-        Matrix<T> operator/=(const Matrix<T> &other);
-        Matrix<T> operator/=(const T &other);
+        Matrix<T> &operator+=(const Matrix<T> &other);
+        Matrix<T> &operator+=(const T &other);
+        Matrix<T> &operator-=(const Matrix<T> &other);
+        Matrix<T> &operator-=(const T &other);
+        Matrix<T> &operator*=(const Matrix<T> &other);
+        Matrix<T> &operator*=(const T &other);
+        Matrix<T> &operator/=(const Matrix<T> &other);
+        Matrix<T> &operator/=(const T &other);
     };
 }
\ No newline at end of file
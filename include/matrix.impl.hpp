@@ -8,6 +8,9 @@
 #include <string>
 #include <omp.h>
 #include "matrix.h"
+#include "gemm.hpp"
+#include "elementwise.hpp"
+#include "linalg.hpp"
 
 #include <xmmintrin.h>
 
@@ -19,33 +22,50 @@ namespace fkZQ
         this->clear();
     }
     template <typename T>
-    Matrix<T>::Matrix() : _data(nullptr), rows(0), cols(0), step(0), size(0) {}
+    Matrix<T>::Matrix() : _data(nullptr), _datastart(nullptr), _refcount(nullptr), rows(0), cols(0), channels(1), step(0), size(0) {}
     template <typename T>
     Matrix<T>::Matrix(Matrix<T> &&other) // move constructor
     {
         this->_data = nullptr;
+        this->_datastart = nullptr;
+        this->_refcount = nullptr;
         this->rows = other.rows;
         this->cols = other.cols;
+        this->channels = other.channels;
         this->step = other.step;
         this->size = other.size;
         std::swap(this->_data, other._data);
+        std::swap(this->_datastart, other._datastart);
+        std::swap(this->_refcount, other._refcount);
     }
     template <typename T>
     Matrix<T>::Matrix(const Matrix<T> &other) // copy constructor
     {
-        FKZQ_NEW
+        this->_data = other._data;
+        this->_datastart = other._datastart;
+        this->_refcount = other._refcount;
         this->rows = other.rows;
         this->cols = other.cols;
-        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols, this->step, this->size);
-        memcpy(this->_data, other._data, this->size);
+        this->channels = other.channels;
+        this->step = other.step;
+        this->size = other.size;
+        if (this->_refcount)
+        {
+            this->_refcount->fetch_add(1, std::memory_order_relaxed);
+        }
     }
     template <typename T>
-    Matrix<T>::Matrix(size_t _rows, size_t _cols)
+    Matrix<T>::Matrix(size_t _rows, size_t _cols) : Matrix(_rows, _cols, (size_t)1) {}
+    template <typename T>
+    Matrix<T>::Matrix(size_t _rows, size_t _cols, size_t _channels)
     {
         FKZQ_NEW
         this->rows = _rows;
         this->cols = _cols;
-        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols, this->step, this->size);
+        this->channels = _channels;
+        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols * this->channels, this->step, this->size);
+        this->_datastart = this->_data;
+        this->_refcount = new std::atomic<int>(1);
     }
     template <typename T>
     Matrix<T>::Matrix(size_t _rows, size_t _cols, const T *_data, bool aligned)
@@ -53,7 +73,10 @@ namespace fkZQ
         FKZQ_NEW
         this->rows = _rows;
         this->cols = _cols;
+        this->channels = 1;
         this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols, this->step, this->size);
+        this->_datastart = this->_data;
+        this->_refcount = new std::atomic<int>(1);
         if (aligned)
         {
             memcpy(this->_data, _data, this->size);
@@ -62,67 +85,179 @@ namespace fkZQ
         {
             for (size_t i = 0; i < this->rows; i++)
             {
-                memcpy(this->ptr(i), _data + i * this->cols, this->cols * sizeof(T));
+                memcpy(this->_data + i * this->step, _data + i * this->cols, this->cols * sizeof(T));
             }
         }
     }
     template <typename T>
-    void Matrix<T>::create(size_t _rows, size_t _cols)
+    Matrix<T> Matrix<T>::wrap(size_t _rows, size_t _cols, size_t _channels, T *_data)
+    {
+#ifdef _FKZQ_USE_SIMD
+        assert((uintptr_t)_data % sizeof(simd<T>) == 0);
+#endif
+        Matrix<T> ret;
+        ret._data = _data;
+        ret._datastart = _data;
+        ret.rows = _rows;
+        ret.cols = _cols;
+        ret.channels = _channels;
+        ret.step = AlignedStep<T>(_cols * _channels);
+        ret.size = _rows * ret.step * sizeof(T);
+        return ret;
+    }
+    template <typename T>
+    Matrix<T> Matrix<T>::wrapReadOnly(size_t _rows, size_t _cols, size_t _channels, const T *_data)
+    {
+        Matrix<T> ret = wrap(_rows, _cols, _channels, const_cast<T *>(_data));
+        // a count with nothing to free, it only tells the copies apart from external buffers they may write to
+        ret._datastart = nullptr;
+        ret._refcount = new std::atomic<int>(1);
+        return ret;
+    }
+    template <typename T>
+    void Matrix<T>::create(size_t _rows, size_t _cols, size_t _channels)
     {
         FKZQ_NEW
         this->clear();
         this->rows = _rows;
         this->cols = _cols;
-        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols, this->step, this->size);
+        this->channels = _channels;
+        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols * this->channels, this->step, this->size);
+        this->_datastart = this->_data;
+        this->_refcount = new std::atomic<int>(1);
     }
     template <typename T>
-    inline bool Matrix<T>::isContinuous() { return true; }
+    inline bool Matrix<T>::isContinuous() const { return true; }
 
     template <typename T>
-    inline void Matrix<T>::clear()
+    Matrix<T> Matrix<T>::clone() const
     {
-        if (this->_data)
+        if (this->_data == nullptr)
         {
-            FKZQ_DELETE
-            AlignedFree(this->_data);
+            return Matrix<T>();
+        }
+        Matrix<T> ret(this->rows, this->cols, this->channels);
+        memcpy(ret._data, this->_data, this->size);
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> Matrix<T>::view(size_t offset, size_t _rows, size_t _cols, size_t _channels) const
+    {
+        Matrix<T> ret(*this);
+        ret._data = this->_data + offset;
+        ret.rows = _rows;
+        ret.cols = _cols;
+        ret.channels = _channels;
+        ret.step = AlignedStep<T>(_cols * _channels);
+        ret.size = _rows * ret.step * sizeof(T);
+        assert(offset % AlignedStep<T>(1) == 0);
+        assert(offset * sizeof(T) + ret.size <= this->size);
+        return ret;
+    }
+
+    template <typename T>
+    inline void Matrix<T>::release()
+    {
+        if (this->_refcount && this->_refcount->fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            if (this->_datastart != nullptr)
+            {
+                FKZQ_DELETE
+                AlignedFree(this->_datastart);
+            }
+            delete this->_refcount;
         }
         this->_data = nullptr;
+        this->_datastart = nullptr;
+        this->_refcount = nullptr;
+    }
+
+    template <typename T>
+    inline void Matrix<T>::detach()
+    {
+        if (this->_refcount && (this->_datastart == nullptr || this->_refcount->load(std::memory_order_acquire) > 1))
+        {
+            *this = this->clone();
+        }
+    }
+
+    template <typename T>
+    inline void Matrix<T>::clear()
+    {
+        this->release();
         this->rows = 0;
         this->cols = 0;
+        this->channels = 1;
     }
     template <typename T>
     inline void Matrix<T>::setZero()
     {
+        if (this->_refcount && (this->_datastart == nullptr || this->_refcount->load(std::memory_order_acquire) > 1))
+        {
+            this->create(this->rows, this->cols, this->channels);
+            return;
+        }
         memset(this->_data, 0, this->size);
     }
 
     template <typename T>
-    inline T *Matrix<T>::data() { return this->_data; }
+    inline T *Matrix<T>::data()
+    {
+        this->detach();
+        return this->_data;
+    }
+    template <typename T>
+    inline const T *Matrix<T>::data() const { return this->_data; }
 
     template <typename T>
-    inline size_t Matrix<T>::col() { return cols; }
+    inline size_t Matrix<T>::col() const { return cols; }
     template <typename T>
-    inline size_t Matrix<T>::row() { return rows; }
+    inline size_t Matrix<T>::row() const { return rows; }
     template <typename T>
-    inline size_t Matrix<T>::elements() { return rows * step; }
+    inline size_t Matrix<T>::elements() const { return rows * step; }
 
     template <typename T>
-    inline T Matrix<T>::operator[](size_t index) { return this->at(index); }
+    inline T Matrix<T>::operator[](size_t index) const { return this->_data[index]; }
     template <typename T>
-    inline T Matrix<T>::operator()(size_t row, size_t col) { return this->at(row, col); }
+    inline T Matrix<T>::operator()(size_t row, size_t col) const { return this->_data[row * this->step + col]; }
 
     template <typename T>
-    inline T &Matrix<T>::at(size_t index) const { return this->_data[index]; }
+    inline T &Matrix<T>::at(size_t index)
+    {
+        this->detach();
+        return this->_data[index];
+    }
     template <typename T>
-    inline T &Matrix<T>::at(size_t row, size_t col) const { return this->_data[row * this->step + col]; }
+    inline T &Matrix<T>::at(size_t row, size_t col)
+    {
+        this->detach();
+        return this->_data[row * this->step + col];
+    }
+    template <typename T>
+    inline const T &Matrix<T>::at(size_t index) const { return this->_data[index]; }
+    template <typename T>
+    inline const T &Matrix<T>::at(size_t row, size_t col) const { return this->_data[row * this->step + col]; }
 
     template <typename T>
-    inline T *Matrix<T>::ptr(size_t row) { return this->_data + row * this->step; }
+    inline T *Matrix<T>::ptr(size_t row)
+    {
+        this->detach();
+        return this->_data + row * this->step;
+    }
+    template <typename T>
+    inline T *Matrix<T>::ptr(size_t row, size_t col)
+    {
+        this->detach();
+        return this->_data + row * this->step + col;
+    }
+    template <typename T>
+    inline const T *Matrix<T>::ptr(size_t row) const { return this->_data + row * this->step; }
     template <typename T>
-    inline T *Matrix<T>::ptr(size_t row, size_t col) { return this->_data + row * this->step + col; }
+    inline const T *Matrix<T>::ptr(size_t row, size_t col) const { return this->_data + row * this->step + col; }
 
     template <typename T>
-    bool inline Matrix<T>::empty() { return this->_data == nullptr || this->rows == 0 || this->cols == 0; }
+    bool inline Matrix<T>::empty() const { return this->_data == nullptr || this->rows == 0 || this->cols == 0; }
 
     template <typename U>
     std::ostream &operator<<(std::ostream &o, const Matrix<U> &mat)
@@ -159,242 +294,221 @@ namespace fkZQ
     }
 
     template <typename T>
-    void Matrix<T>::add(Matrix<T> &ret, const Matrix<T> &other)
+    void Matrix<T>::add(Matrix<T> &ret, const Matrix<T> &other) const
     {
         assert(this->rows == other.rows);
         assert(this->cols == other.cols);
+        assert(this->channels == other.channels);
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] + other._data[i];
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *b = (simd<T> *)other._data;
-        simd<T> *c = (simd<T> *)ret._data;
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] + b[i];
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [](auto a, auto b) { return a + b; }, this->_data, other._data);
     }
 
     template <typename T>
-    void Matrix<T>::add(Matrix<T> &ret, const T &other)
+    void Matrix<T>::add(Matrix<T> &ret, const T &other) const
     {
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] + other;
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *c = (simd<T> *)ret._data;
-        simd<T> b(other);
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] + b;
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [other](auto a) { return a + other; }, this->_data);
     }
 
     template <typename T>
-    void Matrix<T>::sub(Matrix<T> &ret, const Matrix<T> &other)
+    void Matrix<T>::sub(Matrix<T> &ret, const Matrix<T> &other) const
     {
         assert(this->rows == other.rows);
         assert(this->cols == other.cols);
+        assert(this->channels == other.channels);
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] - other._data[i];
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *b = (simd<T> *)other._data;
-        simd<T> *c = (simd<T> *)ret._data;
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] - b[i];
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [](auto a, auto b) { return a - b; }, this->_data, other._data);
     }
 
     template <typename T>
-    void Matrix<T>::sub(Matrix<T> &ret, const T &other)
+    void Matrix<T>::sub(Matrix<T> &ret, const T &other) const
     {
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] - other;
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *c = (simd<T> *)ret._data;
-        simd<T> b(other);
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] - b;
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [other](auto a) { return a - other; }, this->_data);
     }
 
     template <typename T>
-    void Matrix<T>::multiply(Matrix<T> &ret, const Matrix<T> &other)
+    void Matrix<T>::multiply(Matrix<T> &ret, const Matrix<T> &other) const
     {
+        assert(this->channels == 1 && other.channels == 1);
         assert(this->cols == other.rows);
         assert(this->rows == ret.rows);
         assert(other.cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->rows; ++i)
+        if (other.cols == 1)
         {
-            for (size_t j = 0; j < other.cols; ++j)
-            {
-                T sum = 0;
-                for (size_t k = 0; k < this->cols; ++k)
-                {
-                    sum += this->_data[i * this->cols + k] * other._data[k * other.cols + j];
-                }
-                ret.at(i, j) = sum;
-            }
+            this->gemv(ret, other, false);
+            return;
         }
-#else
-        Matrix<T> other_T = other.transpose();
-        for (size_t i = 0; i < this->rows; ++i)
+        if (this->rows == 1)
         {
-            for (size_t j = 0; j < other.cols; ++j)
+            other.gemv(ret, *this, true);
+            return;
+        }
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            // opt-in through Params().strassen, it trades accuracy for fewer multiplications
+            size_t threshold = Params().strassen[TypeClass(sizeof(T))];
+            if (strassen_splits(this->rows, other.cols, this->cols, threshold))
             {
-                simd<T> *a = (simd<T> *)(this->_data + i * this->step);
-                simd<T> *b = (simd<T> *)(other_T._data + j * other_T.step);
-                simd<T> sum(0);
-                int n = this->step / simd<T>::size();
-                for (int k = 0; k < n; ++k)
-                {
-                    sum += a[k] * b[k];
-                }
-                T sum_ = 0;
-                for (int k = 0; k < simd<T>::size(); ++k)
-                {
-                    sum_ += sum[k];
-                }
-                ret.at(i, j) = sum_;
+                strassen(this->rows, other.cols, this->cols, this->_data, this->step, other._data, other.step, ret._data, ret.step, threshold);
+                return;
             }
         }
-#endif
+        gemm(this->rows, other.cols, this->cols, T(1), this->_data, this->step, other._data, other.step, false, T(0), ret._data, ret.step);
     }
 
     template <typename T>
-    void Matrix<T>::multiply(Matrix<T> &ret, const T &other)
+    void Matrix<T>::multiply(Matrix<T> &ret, const T &other) const
     {
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] * other;
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *c = (simd<T> *)ret._data;
-        simd<T> b(other);
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] * b;
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [other](auto a) { return a * other; }, this->_data);
     }
 
     template <typename T>
-    void Matrix<T>::mul(Matrix<T> &ret, const Matrix<T> &other)
+    void Matrix<T>::mul(Matrix<T> &ret, const Matrix<T> &other) const
     {
         assert(this->rows == other.rows);
         assert(this->cols == other.cols);
+        assert(this->channels == other.channels);
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
-        {
-            ret._data[i] = this->_data[i] * other._data[i];
-        }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *b = (simd<T> *)other._data;
-        simd<T> *c = (simd<T> *)ret._data;
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = a[i] * b[i];
-        }
-#endif
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [](auto a, auto b) { return a * b; }, this->_data, other._data);
     }
 
     template <typename T>
-    void Matrix<T>::div(Matrix<T> &ret, const Matrix<T> &other)
+    void Matrix<T>::div(Matrix<T> &ret, const Matrix<T> &other) const
     {
         assert(this->rows == other.rows);
         assert(this->cols == other.cols);
+        assert(this->channels == other.channels);
+        assert(this->rows == ret.rows);
+        assert(this->cols == ret.cols);
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [](auto a, auto b) { return a / b; }, this->_data, other._data);
+    }
+
+    template <typename T>
+    void Matrix<T>::div(Matrix<T> &ret, const T &other) const
+    {
         assert(this->rows == ret.rows);
         assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
+        assert(this->channels == ret.channels);
+        elementwise(this->rows, this->cols * this->channels, this->step, ret._data, [other](auto a) { return a / other; }, this->_data);
+    }
+
+    template <typename T>
+    void Matrix<T>::gemv(Matrix<T> &ret, const Matrix<T> &x, bool trans) const
+    {
+        size_t m = trans ? this->cols : this->rows;
+        size_t n = trans ? this->rows : this->cols;
+        assert(this->channels == 1 && x.channels == 1);
+        assert(x.rows == 1 || x.cols == 1);
+        assert(x.rows * x.cols == n);
+        assert(ret.rows == 1 || ret.cols == 1);
+        assert(ret.rows * ret.cols == m);
+        // a column vector keeps one element per padded row, gather it first
+        T *xbuf = nullptr;
+        const T *xv = x._data;
+        if (x.rows != 1)
         {
-            ret._data[i] = this->_data[i] / other._data[i];
+            xbuf = (T *)AlignedMalloc<T>(n * sizeof(T), false);
+            for (size_t i = 0; i < n; ++i)
+            {
+                xbuf[i] = x._data[i * x.step];
+            }
+            xv = xbuf;
         }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *b = (simd<T> *)other._data;
-        simd<T> *c = (simd<T> *)ret._data;
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
+        if (!trans)
         {
-            c[i] = a[i] / b[i];
+            gemv_n(this->rows, this->cols, this->_data, this->step, xv, ret._data, ret.rows == 1 ? 1 : ret.step);
+        }
+        else if (ret.rows == 1)
+        {
+            gemv_t(this->rows, this->cols, this->_data, this->step, xv, ret._data);
+        }
+        else
+        {
+            T *ybuf = (T *)AlignedMalloc<T>(m * sizeof(T), false);
+            gemv_t(this->rows, this->cols, this->_data, this->step, xv, ybuf);
+            for (size_t i = 0; i < m; ++i)
+            {
+                ret._data[i * ret.step] = ybuf[i];
+            }
+            AlignedFree(ybuf);
+        }
+        if (xbuf)
+        {
+            AlignedFree(xbuf);
         }
-#endif
     }
 
     template <typename T>
-    void Matrix<T>::div(Matrix<T> &ret, const T &other)
+    Matrix<T> Matrix<T>::gemv(const Matrix<T> &x, bool trans) const
     {
-        assert(this->rows == ret.rows);
-        assert(this->cols == ret.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < this->elements(); ++i)
+        size_t m = trans ? this->cols : this->rows;
+        Matrix<T> ret = x.rows == 1 ? Matrix<T>(1, m) : Matrix<T>(m, 1);
+        this->gemv(ret, x, trans);
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> Matrix<T>::inverse() const requires std::is_floating_point_v<T>
+    {
+        assert(this->rows == this->cols);
+        assert(this->channels == 1);
+        Matrix<T> f = this->clone();
+        std::vector<int> piv;
+        if (!lu(f, piv))
         {
-            ret._data[i] = this->_data[i] / other;
+            return Matrix<T>();
         }
-#else
-        simd<T> *a = (simd<T> *)this->_data;
-        simd<T> *c = (simd<T> *)ret._data;
-        simd<T> b(other);
-        size_t n = this->elements() / simd<T>::size();
-        for (size_t i = 0; i < n; ++i)
+        Matrix<T> ret(this->rows, this->cols, this->channels);
+        for (size_t i = 0; i < this->rows; ++i)
         {
-            c[i] = a[i] / b;
+            ret._data[i * ret.step + i] = T(1);
         }
-#endif
+        lu_solve(f, piv, ret);
+        return ret;
     }
 
     template <typename T>
     Matrix<T> Matrix<T>::transpose() const
     {
-        Matrix<T> ret(this->cols, this->rows);
-        for (size_t i = 0; i < this->rows; ++i)
+        // pixels are transposed, the channels of each pixel stay together. square tiles keep both the rows read
+        // and the rows written in L1, bands of tile rows are split over the threads
+        size_t cn = this->channels;
+        Matrix<T> ret(this->cols, this->rows, cn);
+        size_t tb = std::max<size_t>(1, Params().transpose_block[TypeClass(sizeof(T))]);
+        long bands = (long)((this->rows + tb - 1) / tb);
+#pragma omp parallel for schedule(static) if (this->rows * this->cols * cn >= FKZQ_PARALLEL_THRESHOLD)
+        for (long b = 0; b < bands; ++b)
         {
-            for (size_t j = 0; j < this->cols; ++j)
+            size_t i0 = b * tb, i1 = std::min(i0 + tb, this->rows);
+            for (size_t j0 = 0; j0 < this->cols; j0 += tb)
             {
-                ret._data[j * ret.step + i] = this->_data[i * this->step + j];
+                size_t j1 = std::min(j0 + tb, this->cols);
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    const T *src = this->_data + i * this->step;
+                    for (size_t j = j0; j < j1; ++j)
+                    {
+                        for (size_t c = 0; c < cn; ++c)
+                        {
+                            ret._data[j * ret.step + i * cn + c] = src[j * cn + c];
+                        }
+                    }
+                }
             }
         }
         return ret;
@@ -403,26 +517,47 @@ namespace fkZQ
     template <typename T>
     void Matrix<T>::operator=(const Matrix<T> &other)
     {
-        FKZQ_NEW
-        this->clear();
+        if (this == &other)
+        {
+            return;
+        }
+        if (other._refcount)
+        {
+            other._refcount->fetch_add(1, std::memory_order_relaxed);
+        }
+        this->release();
+        this->_data = other._data;
+        this->_datastart = other._datastart;
+        this->_refcount = other._refcount;
         this->rows = other.rows;
         this->cols = other.cols;
-        this->_data = (T *)AlignedMalloc<T>(this->rows, this->cols, this->step, this->size);
-        memcpy(this->_data, other._data, this->size);
+        this->channels = other.channels;
+        this->step = other.step;
+        this->size = other.size;
     }
 
     template <typename T>
     void Matrix<T>::operator=(Matrix<T> &&other)
     {
-        this->clear();
+        if (this == &other)
+        {
+            return;
+        }
+        this->release();
         this->rows = other.rows;
         this->cols = other.cols;
+        this->channels = other.channels;
         this->_data = other._data;
+        this->_datastart = other._datastart;
+        this->_refcount = other._refcount;
         this->step = other.step;
         this->size = other.size;
         other._data = nullptr;
+        other._datastart = nullptr;
+        other._refcount = nullptr;
         other.rows = 0;
         other.cols = 0;
+        other.channels = 1;
         other.step = 0;
         other.size = 0;
     }
@@ -430,7 +565,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator+(const Matrix<T> &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->add(ret, other);
         return ret;
     }
@@ -438,7 +573,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator+(const T &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->add(ret, other);
         return ret;
     }
@@ -446,7 +581,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator-(const Matrix<T> &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->sub(ret, other);
         return ret;
     }
@@ -454,7 +589,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator-(const T &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->sub(ret, other);
         return ret;
     }
@@ -470,7 +605,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator*(const T &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->multiply(ret, other);
         return ret;
     }
@@ -478,7 +613,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::mul(const Matrix<T> &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->mul(ret, other);
         return ret;
     }
@@ -486,7 +621,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator/(const Matrix<T> &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->div(ret, other);
         return ret;
     }
@@ -494,7 +629,7 @@ namespace fkZQ
     template <typename T>
     Matrix<T> Matrix<T>::operator/(const T &other)
     {
-        Matrix<T> ret(this->rows, this->cols);
+        Matrix<T> ret(this->rows, this->cols, this->channels);
         this->div(ret, other);
         return ret;
     }
@@ -502,7 +637,7 @@ namespace fkZQ
     template <typename U>
     Matrix<U> operator+(const U &other, const Matrix<U> &mat)
     {
-        Matrix<U> ret(mat.rows, mat.cols);
+        Matrix<U> ret(mat.rows, mat.cols, mat.channels);
         mat.add(ret, other);
         return ret;
     }
@@ -510,29 +645,15 @@ namespace fkZQ
     template <typename U>
     Matrix<U> operator-(const U &other, const Matrix<U> &mat)
     {
-        Matrix<U> ret(mat.rows, mat.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < mat.elements(); ++i)
-        {
-            ret._data[i] = other - mat._data[i];
-        }
-#else
-        simd<U> *a = (simd<U> *)mat._data;
-        simd<U> *c = (simd<U> *)ret._data;
-        simd<U> b(other);
-        size_t n = mat.elements() / simd<U>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = b - a[i];
-        }
-#endif
+        Matrix<U> ret(mat.rows, mat.cols, mat.channels);
+        elementwise(mat.rows, mat.cols * mat.channels, mat.step, ret._data, [other](auto a) { return other - a; }, mat._data);
         return ret;
     }
 
     template <typename U>
     Matrix<U> operator*(const U &other, const Matrix<U> &mat)
     {
-        Matrix<U> ret(mat.rows, mat.cols);
+        Matrix<U> ret(mat.rows, mat.cols, mat.channels);
         mat.multiply(ret, other);
         return ret;
     }
@@ -540,77 +661,71 @@ namespace fkZQ
     template <typename U>
     Matrix<U> operator/(const U &other, const Matrix<U> &mat)
     {
-        Matrix<U> ret(mat.rows, mat.cols);
-#ifndef _FKZQ_USE_SIMD
-        for (size_t i = 0; i < mat.elements(); ++i)
-        {
-            ret._data[i] = other / mat._data[i];
-        }
-#else
-        simd<U> *a = (simd<U> *)mat._data;
-        simd<U> *c = (simd<U> *)ret._data;
-        simd<U> b(other);
-        size_t n = mat.elements() / simd<U>::size();
-        for (size_t i = 0; i < n; ++i)
-        {
-            c[i] = b / a[i];
-        }
-#endif
+        Matrix<U> ret(mat.rows, mat.cols, mat.channels);
+        elementwise(mat.rows, mat.cols * mat.channels, mat.step, ret._data, [other](auto a) { return other / a; }, mat._data);
         return ret;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator+=(const Matrix<T> &other)
+    Matrix<T> &Matrix<T>::operator+=(const Matrix<T> &other)
     {
+        this->detach();
         this->add(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator+=(const T &other)
+    Matrix<T> &Matrix<T>::operator+=(const T &other)
     {
+        this->detach();
         this->add(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator-=(const Matrix<T> &other)
+    Matrix<T> &Matrix<T>::operator-=(const Matrix<T> &other)
     {
+        this->detach();
         this->sub(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator-=(const T &other)
+    Matrix<T> &Matrix<T>::operator-=(const T &other)
     {
+        this->detach();
         this->sub(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator*=(const Matrix<T> &other)
+    Matrix<T> &Matrix<T>::operator*=(const Matrix<T> &other)
     {
+        this->detach();
         this->mul(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator*=(const T &other)
+    Matrix<T> &Matrix<T>::operator*=(const T &other)
     {
+        this->detach();
         this->multiply(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator/=(const Matrix<T> &other)
+    Matrix<T> &Matrix<T>::operator/=(const Matrix<T> &other)
     {
+        this->detach();
         this->div(*this, other);
         return *this;
     }
 
     template <typename T>
-    Matrix<T> Matrix<T>::operator/=(const T &other)
+    Matrix<T> &Matrix<T>::operator/=(const T &other)
     {
+        this->detach();
         this->div(*this, other);
         return *this;
     }
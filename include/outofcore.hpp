@@ -0,0 +1,277 @@
+#pragma once
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <cstdio>
+#include <mutex>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include "matrix.h"
+#include "gemm.hpp"
+#include "taskgraph.hpp"
+
+#ifndef FKZQ_OOC_BUDGET
+#define FKZQ_OOC_BUDGET ((size_t)256 << 20) // bytes of tile buffers gemm_ooc may hold, both buffer sets included
+#endif
+
+namespace fkZQ
+{
+    // rows x cols matrix of T stored row-major and unpadded in a binary file, read and written by tiles at
+    // explicit offsets, so one reader and one writer may use it at the same time
+    template <typename T>
+    class MatrixFile
+    {
+    public:
+        size_t rows, cols;
+
+        // opens an existing file of exactly rows * cols elements, or creates (truncates) one of that size
+        MatrixFile(const std::string &path, size_t _rows, size_t _cols, bool create = false) : rows(_rows), cols(_cols)
+        {
+            size_t bytes = _rows * _cols * sizeof(T);
+#ifdef _WIN32
+            this->file = std::fopen(path.c_str(), create ? "w+b" : "r+b");
+            if (this->file != nullptr && create && bytes > 0)
+            {
+                // the last byte sizes the file
+                char zero = 0;
+                if (_fseeki64(this->file, (long long)bytes - 1, SEEK_SET) != 0 || std::fwrite(&zero, 1, 1, this->file) != 1)
+                {
+                    std::fclose(this->file);
+                    this->file = nullptr;
+                }
+            }
+#else
+            this->fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+            if (this->fd < 0)
+                return;
+            struct stat st;
+            if (create ? ::ftruncate(this->fd, (off_t)bytes) != 0 : ::fstat(this->fd, &st) != 0 || (size_t)st.st_size != bytes)
+            {
+                ::close(this->fd);
+                this->fd = -1;
+            }
+#endif
+        }
+        MatrixFile(const MatrixFile &) = delete;
+        MatrixFile &operator=(const MatrixFile &) = delete;
+        ~MatrixFile()
+        {
+#ifdef _WIN32
+            if (this->file != nullptr)
+                std::fclose(this->file);
+#else
+            if (this->fd >= 0)
+                ::close(this->fd);
+#endif
+        }
+
+        bool good() const
+        {
+#ifdef _WIN32
+            return this->file != nullptr;
+#else
+            return this->fd >= 0;
+#endif
+        }
+
+        // dst[0:tr, 0:tc] (leading dimension ld) = rows [r0, r0 + tr) and columns [c0, c0 + tc) of the file
+        bool read(size_t r0, size_t c0, size_t tr, size_t tc, T *dst, size_t ld) const
+        {
+            assert(r0 + tr <= this->rows && c0 + tc <= this->cols);
+            return const_cast<MatrixFile *>(this)->transfer(r0, c0, tr, tc, dst, ld, false);
+        }
+        bool write(size_t r0, size_t c0, size_t tr, size_t tc, const T *src, size_t ld)
+        {
+            assert(r0 + tr <= this->rows && c0 + tc <= this->cols);
+            return this->transfer(r0, c0, tr, tc, const_cast<T *>(src), ld, true);
+        }
+        // the tile of the size of m at (r0, c0)
+        bool read(size_t r0, size_t c0, Matrix<T> &m) const
+        {
+            assert(m.channels == 1);
+            return this->read(r0, c0, m.rows, m.cols, m.data(), m.step);
+        }
+        bool write(size_t r0, size_t c0, const Matrix<T> &m)
+        {
+            assert(m.channels == 1);
+            return this->write(r0, c0, m.rows, m.cols, m.data(), m.step);
+        }
+
+    private:
+#ifdef _WIN32
+        std::FILE *file = nullptr;
+        std::mutex lock; // the file position is shared
+#else
+        int fd = -1;
+#endif
+
+        bool transfer(size_t r0, size_t c0, size_t tr, size_t tc, T *buf, size_t ld, bool write)
+        {
+            // full-width tiles are one contiguous range of the file
+            if (c0 == 0 && tc == this->cols && ld == tc)
+            {
+                return this->io((char *)buf, tr * tc * sizeof(T), r0 * this->cols * sizeof(T), write);
+            }
+            for (size_t i = 0; i < tr; ++i)
+            {
+                size_t offset = ((r0 + i) * this->cols + c0) * sizeof(T);
+                if (!this->io((char *)(buf + i * ld), tc * sizeof(T), offset, write))
+                    return false;
+            }
+            return true;
+        }
+
+        bool io(char *p, size_t bytes, size_t offset, bool write)
+        {
+#ifdef _WIN32
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (_fseeki64(this->file, (long long)offset, SEEK_SET) != 0)
+                return false;
+            return (write ? std::fwrite(p, 1, bytes, this->file) : std::fread(p, 1, bytes, this->file)) == bytes;
+#else
+            while (bytes > 0)
+            {
+                ssize_t done = write ? ::pwrite(this->fd, p, bytes, (off_t)offset) : ::pread(this->fd, p, bytes, (off_t)offset);
+                if (done <= 0)
+                    return false;
+                p += done;
+                offset += done;
+                bytes -= done;
+            }
+            return true;
+#endif
+        }
+    };
+
+    // what a gemm_ooc call moved and how long it spent, to tell an I/O-bound run from a compute-bound one
+    struct OocStats
+    {
+        size_t bytes_read = 0, bytes_written = 0;
+        double io_seconds = 0;      // spent in reads and writes, on the I/O thread
+        double compute_seconds = 0; // spent in the in-memory gemm
+        double stall_seconds = 0;   // the compute thread waited for a tile, the part of the I/O not overlapped
+        double wall_seconds = 0;
+        double flops = 0;
+        size_t tile_m = 0, tile_n = 0, tile_k = 0;
+
+        double ioGBps() const { return (this->bytes_read + this->bytes_written) / std::max(this->io_seconds, 1e-9) / 1e9; }
+        double computeGflops() const { return this->flops / std::max(this->compute_seconds, 1e-9) / 1e9; }
+    };
+
+    // c = a * b for matrices on disk: a is m x k, b is k x n, c (m x n) is overwritten. tiles of c are computed one
+    // at a time, streaming tile_m x tile_k blocks of a and tile_k x tile_n blocks of b through two buffer sets, so the
+    // next pair is read while gemm runs on the current one and a finished tile of c is written while the next one is
+    // computed. the file traffic is m n k (1 / tile_m + 1 / tile_n) elements read, so the budget goes to tiles of c
+    // and tile_k is kept at a quarter of their side. returns false if a read or write failed
+    template <typename T>
+    bool gemm_ooc(const MatrixFile<T> &a, const MatrixFile<T> &b, MatrixFile<T> &c, size_t budget = FKZQ_OOC_BUDGET, OocStats *stats = nullptr)
+    {
+        assert(a.cols == b.rows && c.rows == a.rows && c.cols == b.cols);
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        size_t m = a.rows, n = b.cols, k = a.cols;
+        // two sets of (t x t/4 + t/4 x t) read tiles and two t x t tiles of c: 3 t^2 elements
+        size_t t = (size_t)std::sqrt((double)budget / (3.0 * sizeof(T)));
+        t = std::max<size_t>(64, t / 64 * 64);
+        size_t tm = std::min(t, m), tn = std::min(t, n), tk = std::min(std::max<size_t>(16, t / 4), k);
+        OocStats local;
+        OocStats &st = stats != nullptr ? *stats : local;
+        st = OocStats();
+        st.tile_m = tm;
+        st.tile_n = tn;
+        st.tile_k = tk;
+        st.flops = 2.0 * m * n * k;
+        if (m == 0 || n == 0)
+            return true;
+
+        Matrix<T> abuf[2], bbuf[2], cbuf[2];
+        for (int s = 0; s < 2; ++s)
+        {
+            abuf[s].create(tm, std::max<size_t>(tk, 1));
+            bbuf[s].create(std::max<size_t>(tk, 1), tn);
+            cbuf[s].create(tm, tn);
+        }
+        // one worker, so reads and writes reach the disk in the order they were queued
+        ThreadPool io(1);
+        std::atomic<bool> failed{false};
+        std::mutex timing;
+        auto job = [&](std::function<bool()> f)
+        {
+            auto done = std::make_shared<std::promise<void>>();
+            std::future<void> ready = done->get_future();
+            io.submit([&, f, done]
+                      {
+                auto t0 = clock::now();
+                if (!f())
+                    failed = true;
+                std::chrono::duration<double> d = clock::now() - t0;
+                {
+                    std::lock_guard<std::mutex> guard(timing);
+                    st.io_seconds += d.count();
+                }
+                done->set_value(); });
+            return ready;
+        };
+
+        // the steps in order: every tile of c, and for each of them every block of the depth
+        size_t mt = (m + tm - 1) / tm, nt = (n + tn - 1) / tn, kt = k == 0 ? 1 : (k + tk - 1) / tk;
+        size_t steps = mt * nt * kt;
+        auto fetch = [&](size_t s, int set)
+        {
+            size_t p = s % kt, j = s / kt % nt, i = s / kt / nt;
+            size_t i0 = i * tm, j0 = j * tn, p0 = p * tk;
+            size_t mr = std::min(tm, m - i0), nr = std::min(tn, n - j0), kr = std::min(tk, k - p0);
+            st.bytes_read += (mr * kr + kr * nr) * sizeof(T);
+            return job([&a, &b, &abuf, &bbuf, set, i0, j0, p0, mr, nr, kr]
+                       { return a.read(i0, p0, mr, kr, abuf[set].data(), abuf[set].step) &&
+                                b.read(p0, j0, kr, nr, bbuf[set].data(), bbuf[set].step); });
+        };
+        std::future<void> pending = k > 0 ? fetch(0, 0) : std::future<void>();
+        std::future<void> written[2];
+        for (size_t s = 0; s < steps && !failed; ++s)
+        {
+            size_t p = s % kt, tile = s / kt;
+            size_t j = tile % nt, i = tile / nt;
+            size_t i0 = i * tm, j0 = j * tn, p0 = p * tk;
+            size_t mr = std::min(tm, m - i0), nr = std::min(tn, n - j0), kr = k == 0 ? 0 : std::min(tk, k - p0);
+            int set = s & 1, cset = tile & 1;
+            auto t0 = clock::now();
+            if (pending.valid())
+                pending.wait();
+            if (s + 1 < steps && k > 0)
+                pending = fetch(s + 1, set ^ 1);
+            // the buffer of c was last used two tiles ago, its write has to be done before it is overwritten
+            if (p == 0 && written[cset].valid())
+                written[cset].wait();
+            auto t1 = clock::now();
+            gemm(mr, nr, kr, T(1), abuf[set].data(), abuf[set].step, bbuf[set].data(), bbuf[set].step, false,
+                 p == 0 ? T(0) : T(1), cbuf[cset].data(), cbuf[cset].step);
+            auto t2 = clock::now();
+            st.stall_seconds += std::chrono::duration<double>(t1 - t0).count();
+            st.compute_seconds += std::chrono::duration<double>(t2 - t1).count();
+            if (p + 1 == kt)
+            {
+                st.bytes_written += mr * nr * sizeof(T);
+                written[cset] = job([&c, &cbuf, cset, i0, j0, mr, nr]
+                                    { return c.write(i0, j0, mr, nr, cbuf[cset].data(), cbuf[cset].step); });
+            }
+        }
+        // drain the queue before the buffers go away
+        if (pending.valid())
+            pending.wait();
+        for (auto &w : written)
+        {
+            if (w.valid())
+                w.wait();
+        }
+        st.wall_seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return !failed;
+    }
+}
@@ -0,0 +1,258 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// kernel parameters are runtime values (see KernelParams). defining FKZQ_PARALLEL_THRESHOLD, FKZQ_GEMM_MC,
+// FKZQ_GEMM_KC, FKZQ_GEMM_NC or FKZQ_STRASSEN_THRESHOLD at build time pins that value: the config file and the
+// tuner no longer change it
+#ifdef FKZQ_PARALLEL_THRESHOLD
+#define FKZQ_PARALLEL_THRESHOLD_PINNED FKZQ_PARALLEL_THRESHOLD
+#else
+#define FKZQ_PARALLEL_THRESHOLD (::fkZQ::Params().parallel_threshold) // work items below which kernels stay on the calling thread
+#endif
+#define FKZQ_PARALLEL_THRESHOLD_DEFAULT (1 << 16)
+
+#ifndef FKZQ_TUNE_FILE
+#define FKZQ_TUNE_FILE "fkzq_tune.cfg" // config read at startup unless the FKZQ_TUNE_FILE environment variable names another
+#endif
+
+namespace fkZQ
+{
+    // data cache of the given level in bytes, level 3 falls back to level 2 where there is none
+    inline size_t CacheSize(int level)
+    {
+        long size = -1;
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+        if (level == 1)
+            size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+        else if (level == 2)
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        else
+        {
+            size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+            if (size <= 0)
+                size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        }
+#endif
+        if (size > 0)
+            return (size_t)size;
+        return level == 1 ? (size_t)32 << 10 : level == 2 ? (size_t)256 << 10 : (size_t)8 << 20;
+    }
+
+    inline size_t LastLevelCacheSize() { return CacheSize(3); }
+
+    // parameters are kept per element width: 1, 2, 4 and 8 bytes, named after the type of that width the
+    // kernels are mostly used with. int and unsigned int use the float entries, and so on
+    inline int TypeClass(size_t bytes) { return bytes <= 1 ? 0 : bytes == 2 ? 1 : bytes <= 4 ? 2 : 3; }
+    inline const char *TypeClassName(int c)
+    {
+        static const char *names[] = {"uchar", "ushort", "float", "double"};
+        return names[c];
+    }
+
+    enum GemmShapes
+    {
+        GEMM_SMALL = 0, // m * n * k below 2^24, about 256^3
+        GEMM_LARGE = 1,
+    };
+
+    struct GemmBlocks
+    {
+        size_t mc; // rows of a packed block of A, kept in L2
+        size_t kc; // depth of the packed panels, an A and a B sliver stay in L1
+        size_t nc; // columns of a packed panel of B, kept in L3
+    };
+
+    // per-machine kernel parameters. they start from values derived from the cache sizes, then the config file
+    // written by the tune target (FKZQ_TUNE_FILE) overrides what it lists, then build-time pins apply. the
+    // kernels read Params() on every call, so changing a field takes effect on the next call
+    struct KernelParams
+    {
+        size_t parallel_threshold;
+        GemmBlocks gemm[4][2]; // [type class][shape]
+        size_t transpose_block[4]; // pixels per side of a transposed tile
+        size_t box_strip[4];       // output rows per strip of box_filter_s, by sum type; 0 sizes strips to L2
+        size_t strassen[4];        // smallest side at which a float or double multiply recurses by Strassen-Winograd; 0 is off
+        std::string source;        // config file the values came from, empty for the defaults
+
+        static KernelParams defaults()
+        {
+            KernelParams p;
+            p.parallel_threshold = FKZQ_PARALLEL_THRESHOLD_DEFAULT;
+            size_t l1 = CacheSize(1), l2 = CacheSize(2), l3 = CacheSize(3);
+            // GemmTile: MR = 4 rows, NR = two vectors of columns
+#ifdef _FKZQ_USE_SIMD
+            size_t nrs[4] = {2 * simd<unsigned char>::size(), 2 * simd<unsigned short>::size(), 2 * simd<float>::size(), 2 * simd<double>::size()};
+#else
+            size_t nrs[4] = {4, 4, 4, 4};
+#endif
+            for (int c = 0; c < 4; ++c)
+            {
+                size_t e = (size_t)1 << c;
+                size_t mr = 4, nr = nrs[c];
+                GemmBlocks b;
+                b.kc = std::clamp<size_t>(l1 / 2 / ((mr + nr) * e) / 16 * 16, 64, 1024);
+                b.mc = std::clamp<size_t>(l2 / 2 / (b.kc * e) / mr * mr, 16, 1024);
+                b.nc = std::clamp<size_t>(l3 / 4 / (b.kc * e) / nr * nr, 16 * nr, 8192);
+                p.gemm[c][GEMM_SMALL] = b;
+                p.gemm[c][GEMM_LARGE] = b;
+                // a source and a destination tile in half of L1
+                size_t t = 8;
+                while (t < 256 && 2 * (2 * t) * (2 * t) * e <= l1 / 2)
+                    t *= 2;
+                p.transpose_block[c] = t;
+                p.box_strip[c] = 0;
+                p.strassen[c] = 0;
+            }
+            return p;
+        }
+
+        // key = value lines as written by save(), '#' starts a comment. unknown keys are reported and skipped
+        bool load(const std::string &path)
+        {
+            std::ifstream in(path);
+            if (!in)
+                return false;
+            std::string line;
+            while (std::getline(in, line))
+            {
+                line = line.substr(0, line.find('#'));
+                size_t eq = line.find('=');
+                if (eq == std::string::npos)
+                    continue;
+                std::string key, value;
+                std::istringstream(line.substr(0, eq)) >> key;
+                std::istringstream(line.substr(eq + 1)) >> value;
+                size_t *field = this->find(key);
+                if (field == nullptr || value.empty())
+                {
+                    std::cerr << "fkZQ: ignoring '" << key << "' in " << path << std::endl;
+                    continue;
+                }
+                *field = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            this->source = path;
+            return true;
+        }
+
+        bool save(const std::string &path) const
+        {
+            std::ofstream out(path);
+            if (!out)
+                return false;
+            out << "# fkZQ kernel parameters, written by the tune target\n";
+            this->print(out);
+            return (bool)out;
+        }
+
+        void print(std::ostream &o) const
+        {
+            o << "parallel_threshold = " << this->parallel_threshold << "\n";
+            for (int c = 0; c < 4; ++c)
+            {
+                for (int s = 0; s < 2; ++s)
+                {
+                    const GemmBlocks &b = this->gemm[c][s];
+                    std::string k = std::string("gemm.") + TypeClassName(c) + (s == GEMM_SMALL ? ".small" : ".large");
+                    o << k << ".mc = " << b.mc << "\n"
+                      << k << ".kc = " << b.kc << "\n"
+                      << k << ".nc = " << b.nc << "\n";
+                }
+            }
+            for (int c = 0; c < 4; ++c)
+                o << "transpose." << TypeClassName(c) << ".block = " << this->transpose_block[c] << "\n";
+            for (int c = 0; c < 4; ++c)
+                o << "box_filter." << TypeClassName(c) << ".strip = " << this->box_strip[c] << "\n";
+            for (int c = 2; c < 4; ++c)
+                o << "gemm." << TypeClassName(c) << ".strassen = " << this->strassen[c] << "\n";
+        }
+
+        template <typename T>
+        const GemmBlocks &gemmBlocks(size_t m, size_t n, size_t k) const
+        {
+            double work = (double)m * n * k;
+            return this->gemm[TypeClass(sizeof(T))][work < 16777216.0 ? GEMM_SMALL : GEMM_LARGE];
+        }
+
+        size_t *find(const std::string &key)
+        {
+            if (key == "parallel_threshold")
+                return &this->parallel_threshold;
+            for (int c = 0; c < 4; ++c)
+            {
+                std::string t = TypeClassName(c);
+                for (int s = 0; s < 2; ++s)
+                {
+                    std::string k = "gemm." + t + (s == GEMM_SMALL ? ".small" : ".large");
+                    if (key == k + ".mc")
+                        return &this->gemm[c][s].mc;
+                    if (key == k + ".kc")
+                        return &this->gemm[c][s].kc;
+                    if (key == k + ".nc")
+                        return &this->gemm[c][s].nc;
+                }
+                if (key == "transpose." + t + ".block")
+                    return &this->transpose_block[c];
+                if (key == "box_filter." + t + ".strip")
+                    return &this->box_strip[c];
+                if (key == "gemm." + t + ".strassen")
+                    return &this->strassen[c];
+            }
+            return nullptr;
+        }
+
+        // build-time pins win over everything else
+        void pin()
+        {
+#ifdef FKZQ_PARALLEL_THRESHOLD_PINNED
+            this->parallel_threshold = FKZQ_PARALLEL_THRESHOLD_PINNED;
+#endif
+            for (int c = 0; c < 4; ++c)
+            {
+                for (int s = 0; s < 2; ++s)
+                {
+#ifdef FKZQ_GEMM_MC
+                    this->gemm[c][s].mc = FKZQ_GEMM_MC;
+#endif
+#ifdef FKZQ_GEMM_KC
+                    this->gemm[c][s].kc = FKZQ_GEMM_KC;
+#endif
+#ifdef FKZQ_GEMM_NC
+                    this->gemm[c][s].nc = FKZQ_GEMM_NC;
+#endif
+                }
+#ifdef FKZQ_STRASSEN_THRESHOLD
+                this->strassen[c] = FKZQ_STRASSEN_THRESHOLD;
+#endif
+            }
+        }
+
+        static std::string configPath()
+        {
+            const char *env = std::getenv("FKZQ_TUNE_FILE");
+            return env && *env ? env : FKZQ_TUNE_FILE;
+        }
+    };
+
+    // the parameters in effect, loaded on first use
+    inline KernelParams &Params()
+    {
+        static KernelParams params = []
+        {
+            KernelParams p = KernelParams::defaults();
+            p.load(KernelParams::configPath());
+            p.pin();
+            return p;
+        }();
+        return params;
+    }
+}
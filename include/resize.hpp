@@ -0,0 +1,323 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "matrix.h"
+
+namespace fkZQ
+{
+    enum InterpolationFlags
+    {
+        INTER_LINEAR = 1,
+        INTER_AREA = 3, // exact 2x downsampling only
+    };
+
+    enum PyramidTypes
+    {
+        PYR_GAUSSIAN = 0, // 5x5 Gaussian then every other pixel, like pyrDown
+        PYR_AREA = 1,     // mean of every 2x2 block
+    };
+
+    // intermediate rows are kept in float, double matrices keep their precision. every sum of the integer
+    // kernels below stays under 2^24 and is exact in float
+    template <typename T>
+    using ResizeWork = std::conditional_t<std::is_same_v<T, double>, double, float>;
+
+    inline int reflect101(int p, int n)
+    {
+        if (n == 1)
+            return 0;
+        while (p < 0 || p >= n)
+            p = p < 0 ? -p : 2 * n - 2 - p;
+        return p;
+    }
+
+    // dst[0:n] = src[0:n] * scale, rounded to nearest for integer T
+    template <typename WT, typename T>
+    inline void cast_row(const WT *src, T *dst, size_t n, WT scale)
+    {
+        constexpr bool round = !std::is_floating_point_v<T>;
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<WT>::size();
+        for (; j + W <= n; j += W)
+        {
+            stdx::fixed_size_simd<WT, W> v(src + j, stdx::element_aligned);
+            v *= scale;
+            if constexpr (round)
+                v = stdx::floor(v + WT(0.5));
+            stdx::static_simd_cast<T>(v).copy_to(dst + j, stdx::element_aligned);
+        }
+#endif
+        for (; j < n; ++j)
+        {
+            WT v = src[j] * scale;
+            dst[j] = round ? (T)std::floor(v + WT(0.5)) : (T)v;
+        }
+    }
+
+    // out[0:n] = WT(a[0:n]) + WT(b[0:n])
+    template <typename T, typename WT>
+    inline void widen_add(const T *a, const T *b, WT *out, size_t n)
+    {
+        size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+        constexpr size_t W = simd<WT>::size();
+        for (; j + W <= n; j += W)
+        {
+            auto va = stdx::static_simd_cast<WT>(stdx::fixed_size_simd<T, W>(a + j, stdx::element_aligned));
+            auto vb = stdx::static_simd_cast<WT>(stdx::fixed_size_simd<T, W>(b + j, stdx::element_aligned));
+            (va + vb).copy_to(out + j, stdx::element_aligned);
+        }
+#endif
+        for (; j < n; ++j)
+            out[j] = (WT)a[j] + (WT)b[j];
+    }
+
+    // 2x2 box sums of sh x sw pixels into (sh / 2) x (sw / 2): the rows are added with simd, then the pixel pairs
+    template <typename T>
+    void pyr_down_area(const T *src, size_t sstep, size_t sh, size_t sw, T *dst, size_t dstep, size_t cn)
+    {
+        using WT = ResizeWork<T>;
+        size_t dh = sh / 2, dw = sw / 2;
+        size_t n = dw * cn;
+#pragma omp parallel if (sh * sw * cn >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            WT *v = (WT *)AlignedMalloc<WT>(2 * n * sizeof(WT), false);
+            WT *h = (WT *)AlignedMalloc<WT>(n * sizeof(WT), false);
+#pragma omp for schedule(static)
+            for (long y = 0; y < (long)dh; ++y)
+            {
+                widen_add(src + 2 * y * sstep, src + (2 * y + 1) * sstep, v, 2 * n);
+                for (size_t x = 0; x < dw; ++x)
+                    for (size_t c = 0; c < cn; ++c)
+                        h[x * cn + c] = v[2 * x * cn + c] + v[(2 * x + 1) * cn + c];
+                cast_row(h, dst + y * dstep, n, WT(0.25));
+            }
+            AlignedFree(v);
+            AlignedFree(h);
+        }
+    }
+
+    // [1 4 6 4 1]^2 / 256 Gaussian of sh x sw pixels sampled at the even pixels into ((sh + 1) / 2) x ((sw + 1) / 2),
+    // reflect-101 borders. the vertical taps run first with simd over the five source rows, so the strided
+    // horizontal taps are only computed for the destination rows
+    template <typename T>
+    void pyr_down_gauss(const T *src, size_t sstep, size_t sh, size_t sw, T *dst, size_t dstep, size_t cn)
+    {
+        using WT = ResizeWork<T>;
+        size_t dh = (sh + 1) / 2, dw = (sw + 1) / 2;
+        size_t n = dw * cn, sn = sw * cn;
+        std::vector<int> tab(dw * 5);
+        for (size_t x = 0; x < dw; ++x)
+            for (int k = 0; k < 5; ++k)
+                tab[x * 5 + k] = reflect101((int)(2 * x) - 2 + k, (int)sw) * (int)cn;
+#pragma omp parallel if (sh * sw * cn >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            WT *v = (WT *)AlignedMalloc<WT>(sn * sizeof(WT), false);
+            WT *h = (WT *)AlignedMalloc<WT>(n * sizeof(WT), false);
+#pragma omp for schedule(static)
+            for (long y = 0; y < (long)dh; ++y)
+            {
+                const T *r0 = src + reflect101(2 * (int)y - 2, (int)sh) * sstep;
+                const T *r1 = src + reflect101(2 * (int)y - 1, (int)sh) * sstep;
+                const T *r2 = src + reflect101(2 * (int)y, (int)sh) * sstep;
+                const T *r3 = src + reflect101(2 * (int)y + 1, (int)sh) * sstep;
+                const T *r4 = src + reflect101(2 * (int)y + 2, (int)sh) * sstep;
+                size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+                constexpr size_t W = simd<WT>::size();
+                using V = stdx::fixed_size_simd<WT, W>;
+                auto load = [](const T *p) { return stdx::static_simd_cast<WT>(stdx::fixed_size_simd<T, W>(p, stdx::element_aligned)); };
+                for (; j + W <= sn; j += W)
+                {
+                    V s = load(r0 + j) + load(r4 + j) + WT(4) * (load(r1 + j) + load(r3 + j)) + WT(6) * load(r2 + j);
+                    s.copy_to(v + j, stdx::element_aligned);
+                }
+#endif
+                for (; j < sn; ++j)
+                    v[j] = (WT)r0[j] + (WT)r4[j] + WT(4) * ((WT)r1[j] + (WT)r3[j]) + WT(6) * (WT)r2[j];
+                for (size_t x = 0; x < dw; ++x)
+                {
+                    if (x >= 1 && 2 * x + 2 < sw)
+                    {
+                        const WT *p = v + (2 * x - 2) * cn;
+                        for (size_t c = 0; c < cn; ++c)
+                            h[x * cn + c] = p[c] + p[c + 4 * cn] + WT(4) * (p[c + cn] + p[c + 3 * cn]) + WT(6) * p[c + 2 * cn];
+                    }
+                    else
+                    {
+                        const int *t = &tab[x * 5];
+                        for (size_t c = 0; c < cn; ++c)
+                            h[x * cn + c] = v[t[0] + c] + v[t[4] + c] + WT(4) * (v[t[1] + c] + v[t[3] + c]) + WT(6) * v[t[2] + c];
+                    }
+                }
+                cast_row(h, dst + y * dstep, n, WT(1) / WT(256));
+            }
+            AlignedFree(v);
+            AlignedFree(h);
+        }
+    }
+
+    // bilinear resize of sh x sw pixels to dh x dw with pixel centers aligned, like cv::resize INTER_LINEAR.
+    // each thread keeps its last two horizontally interpolated source rows, consecutive destination rows mostly
+    // reuse them
+    template <typename T>
+    void resize_linear(const T *src, size_t sstep, size_t sh, size_t sw, T *dst, size_t dstep, size_t dh, size_t dw, size_t cn)
+    {
+        using WT = ResizeWork<T>;
+        size_t n = dw * cn;
+        std::vector<int> xofs(dw * 2), yofs(dh * 2);
+        std::vector<WT> alpha(dw), beta(dh);
+        auto coeffs = [](size_t d, size_t s, std::vector<int> &ofs, std::vector<WT> &w)
+        {
+            double scale = (double)s / d;
+            for (size_t i = 0; i < d; ++i)
+            {
+                double f = (i + 0.5) * scale - 0.5;
+                int p = (int)std::floor(f);
+                f -= p;
+                if (p < 0)
+                {
+                    f = 0;
+                    p = 0;
+                }
+                if (p >= (int)s - 1)
+                {
+                    f = 0;
+                    p = (int)s - 1;
+                }
+                ofs[i * 2] = p;
+                ofs[i * 2 + 1] = std::min(p + 1, (int)s - 1);
+                w[i] = (WT)f;
+            }
+        };
+        coeffs(dw, sw, xofs, alpha);
+        coeffs(dh, sh, yofs, beta);
+        for (size_t i = 0; i < dw * 2; ++i)
+            xofs[i] *= (int)cn;
+#pragma omp parallel if (dh * n >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            size_t hstep = AlignedStep<WT>(n);
+            WT *hbuf = (WT *)AlignedMalloc<WT>(3 * hstep * sizeof(WT), false);
+            WT *h[2] = {hbuf, hbuf + hstep};
+            WT *vbuf = hbuf + 2 * hstep;
+            int rows[2] = {-1, -1};
+            auto hrow = [&](int sy, WT *out)
+            {
+                const T *s = src + sy * sstep;
+                for (size_t x = 0; x < dw; ++x)
+                {
+                    WT a = alpha[x];
+                    const T *p0 = s + xofs[x * 2], *p1 = s + xofs[x * 2 + 1];
+                    for (size_t c = 0; c < cn; ++c)
+                        out[x * cn + c] = (WT)p0[c] + a * ((WT)p1[c] - (WT)p0[c]);
+                }
+            };
+#pragma omp for schedule(static)
+            for (long y = 0; y < (long)dh; ++y)
+            {
+                int sy0 = yofs[y * 2], sy1 = yofs[y * 2 + 1];
+                if (rows[0] != sy0)
+                {
+                    if (rows[1] == sy0)
+                    {
+                        std::swap(h[0], h[1]);
+                        std::swap(rows[0], rows[1]);
+                    }
+                    else
+                    {
+                        hrow(sy0, h[0]);
+                        rows[0] = sy0;
+                    }
+                }
+                if (rows[1] != sy1)
+                {
+                    hrow(sy1, h[1]);
+                    rows[1] = sy1;
+                }
+                WT b = beta[y];
+                const WT *r0 = h[0], *r1 = h[1];
+                size_t j = 0;
+#ifdef _FKZQ_USE_SIMD
+                constexpr size_t W = simd<WT>::size();
+                for (; j + W <= n; j += W)
+                {
+                    simd<WT> v0(r0 + j, stdx::vector_aligned);
+                    (v0 + b * (simd<WT>(r1 + j, stdx::vector_aligned) - v0)).copy_to(vbuf + j, stdx::vector_aligned);
+                }
+#endif
+                for (; j < n; ++j)
+                    vbuf[j] = r0[j] + b * (r1[j] - r0[j]);
+                cast_row(vbuf, dst + y * dstep, n, WT(1));
+            }
+            AlignedFree(hbuf);
+        }
+    }
+
+    // Gaussian pyrDown to ((rows + 1) / 2) x ((cols + 1) / 2)
+    template <typename T>
+    void pyrDown(const Matrix<T> &src, Matrix<T> &dst)
+    {
+        size_t dh = (src.rows + 1) / 2, dw = (src.cols + 1) / 2;
+        if (dst.rows != dh || dst.cols != dw || dst.channels != src.channels)
+            dst.create(dh, dw, src.channels);
+        pyr_down_gauss(src.data(), src.step, src.rows, src.cols, dst.data(), dst.step, src.channels);
+    }
+
+    template <typename T>
+    void resize(const Matrix<T> &src, Matrix<T> &dst, size_t rows, size_t cols, int interpolation = INTER_LINEAR)
+    {
+        assert(rows > 0 && cols > 0);
+        if (dst.rows != rows || dst.cols != cols || dst.channels != src.channels)
+            dst.create(rows, cols, src.channels);
+        if (interpolation == INTER_AREA)
+        {
+            assert(rows == src.rows / 2 && cols == src.cols / 2);
+            pyr_down_area(src.data(), src.step, src.rows, src.cols, dst.data(), dst.step, src.channels);
+            return;
+        }
+        resize_linear(src.data(), src.step, src.rows, src.cols, dst.data(), dst.step, rows, cols, src.channels);
+    }
+
+    // levels[0] shares src, levels[1 .. maxlevel] are halved with method (PyramidTypes) and are views of one
+    // allocation holding all of them
+    template <typename T>
+    void buildPyramid(const Matrix<T> &src, std::vector<Matrix<T>> &levels, int maxlevel, int method = PYR_GAUSSIAN)
+    {
+        size_t cn = src.channels;
+        std::vector<size_t> h(maxlevel + 1), w(maxlevel + 1), offset(maxlevel + 1);
+        h[0] = src.rows;
+        w[0] = src.cols;
+        size_t total = 0;
+        for (int l = 1; l <= maxlevel; ++l)
+        {
+            h[l] = method == PYR_AREA ? h[l - 1] / 2 : (h[l - 1] + 1) / 2;
+            w[l] = method == PYR_AREA ? w[l - 1] / 2 : (w[l - 1] + 1) / 2;
+            assert(h[l] > 0 && w[l] > 0);
+            offset[l] = total;
+            total += h[l] * AlignedStep<T>(w[l] * cn);
+        }
+        levels.resize(maxlevel + 1);
+        levels[0] = src;
+        if (maxlevel == 0)
+            return;
+        Matrix<T> buffer(1, total);
+        T *base = buffer.data();
+        for (int l = 1; l <= maxlevel; ++l)
+        {
+            const T *s = l == 1 ? src.data() : base + offset[l - 1];
+            size_t sstep = l == 1 ? src.step : AlignedStep<T>(w[l - 1] * cn);
+            T *d = base + offset[l];
+            size_t dstep = AlignedStep<T>(w[l] * cn);
+            if (method == PYR_AREA)
+                pyr_down_area(s, sstep, h[l - 1], w[l - 1], d, dstep, cn);
+            else
+                pyr_down_gauss(s, sstep, h[l - 1], w[l - 1], d, dstep, cn);
+        }
+        for (int l = 1; l <= maxlevel; ++l)
+            levels[l] = buffer.view(offset[l], h[l], w[l], cn);
+    }
+}
@@ -0,0 +1,365 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix.h"
+
+// sharing matrices between processes of one host through POSIX shared memory, without copies on the reading side
+
+#ifndef FKZQ_SHM_SLOTS
+#define FKZQ_SHM_SLOTS 3 // frames a SharedMatrix keeps, a reader has slots - 1 publications to finish with a frame
+#endif
+
+namespace fkZQ
+{
+    // one mapping of a named POSIX shared memory object. the creator maps it read-write and removes the name when
+    // the segment is destroyed, if the name still refers to it; processes already attached keep their mapping until
+    // they drop it
+    class ShmSegment
+    {
+    public:
+        std::string name;
+        void *base = nullptr;
+        size_t bytes = 0;
+        bool owner = false;
+
+        // create makes a new object of bytes bytes, failing if the name exists unless replace removes the object
+        // behind it first; otherwise the existing one is mapped read-only at its full size
+        ShmSegment(const std::string &_name, size_t _bytes, bool create, bool replace = false) : name(_name[0] == '/' ? _name : "/" + _name), owner(create)
+        {
+            int fd;
+            if (create)
+            {
+                if (replace)
+                    shm_unlink(this->name.c_str());
+                fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+                if (fd < 0)
+                    return;
+                struct stat st;
+                if (fstat(fd, &st) == 0)
+                {
+                    this->dev = st.st_dev;
+                    this->ino = st.st_ino;
+                }
+                if (ftruncate(fd, (off_t)_bytes) != 0)
+                {
+                    ::close(fd);
+                    shm_unlink(this->name.c_str());
+                    return;
+                }
+            }
+            else
+            {
+                fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+                struct stat st;
+                if (fd < 0)
+                    return;
+                if (fstat(fd, &st) != 0)
+                {
+                    ::close(fd);
+                    return;
+                }
+                _bytes = (size_t)st.st_size;
+            }
+            void *p = mmap(nullptr, _bytes, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd); // the mapping keeps the object alive
+            if (p == MAP_FAILED)
+            {
+                if (create)
+                    shm_unlink(this->name.c_str());
+                return;
+            }
+            this->base = p;
+            this->bytes = _bytes;
+        }
+        ShmSegment(const ShmSegment &) = delete;
+        ShmSegment &operator=(const ShmSegment &) = delete;
+        ~ShmSegment()
+        {
+            if (this->base != nullptr)
+                munmap(this->base, this->bytes);
+            if (this->owner && this->base != nullptr && this->named())
+                shm_unlink(this->name.c_str());
+        }
+
+        bool good() const { return this->base != nullptr; }
+
+    private:
+        dev_t dev = 0;
+        ino_t ino = 0;
+
+        // the name still refers to the object this segment created, not to one that replaced it
+        bool named() const
+        {
+            int fd = shm_open(this->name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            bool same = fstat(fd, &st) == 0 && st.st_dev == this->dev && st.st_ino == this->ino;
+            ::close(fd);
+            return same;
+        }
+    };
+
+    // segments this process has mapped, by name, so attaching twice shares one mapping
+    class ShmRegistry
+    {
+    public:
+        static ShmRegistry &instance()
+        {
+            static ShmRegistry registry;
+            return registry;
+        }
+
+        std::shared_ptr<ShmSegment> create(const std::string &name, size_t bytes, bool replace = false)
+        {
+            auto seg = std::make_shared<ShmSegment>(name, bytes, true, replace);
+            if (!seg->good())
+                return nullptr;
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->segments[seg->name] = seg;
+            return seg;
+        }
+
+        std::shared_ptr<ShmSegment> attach(const std::string &name)
+        {
+            std::string key = name[0] == '/' ? name : "/" + name;
+            std::lock_guard<std::mutex> guard(this->lock);
+            auto it = this->segments.find(key);
+            if (it != this->segments.end())
+            {
+                if (auto seg = it->second.lock())
+                    return seg;
+            }
+            auto seg = std::make_shared<ShmSegment>(key, 0, false);
+            if (!seg->good())
+                return nullptr;
+            this->segments[key] = seg;
+            return seg;
+        }
+
+        // names of the segments still mapped
+        std::vector<std::string> names()
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            std::vector<std::string> ret;
+            for (auto it = this->segments.begin(); it != this->segments.end();)
+            {
+                if (it->second.expired())
+                {
+                    it = this->segments.erase(it);
+                    continue;
+                }
+                ret.push_back(it->first);
+                ++it;
+            }
+            return ret;
+        }
+
+    private:
+        std::mutex lock;
+        std::unordered_map<std::string, std::weak_ptr<ShmSegment>> segments;
+    };
+
+    // start of a SharedMatrix segment. the slots follow at data_offset, slot_bytes apart
+    struct ShmHeader
+    {
+        static constexpr uint64_t MAGIC = 0x6b5a51534d484631ull; // written last by the creator
+        static constexpr size_t MAX_SLOTS = 16;
+        std::atomic<uint64_t> magic;
+        uint64_t elem_size, rows, cols, channels, step;
+        uint64_t slots, slot_bytes, data_offset;
+        std::atomic<uint64_t> frames;                // frames published, frame f (from 1) lives in slot (f - 1) % slots
+        std::atomic<uint64_t> seq[MAX_SLOTS];        // 2 f - 1 while frame f is written to the slot, 2 f once complete
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the sequence counters are shared between processes");
+
+    // a rows x cols x channels matrix published by one process and read by others. the creator writes frames into
+    // a ring of slots; every slot has a sequence counter (a seqlock) so a reader can tell a complete frame from one
+    // being overwritten without any lock. readers get views of the slots, not copies
+    template <typename T>
+    class SharedMatrix
+    {
+    public:
+        size_t rows = 0, cols = 0, channels = 0;
+
+        SharedMatrix() = default;
+
+        // creates the segment name, this process becomes the only writer. not good() if a SharedMatrix of that name is
+        // live; an object left without a complete header is taken over, and replace takes over any (e.g. the one of
+        // a publisher that crashed)
+        static SharedMatrix create(const std::string &name, size_t rows, size_t cols, size_t channels = 1, size_t slots = FKZQ_SHM_SLOTS, bool replace = false)
+        {
+            assert(slots >= 1 && slots <= ShmHeader::MAX_SLOTS);
+            SharedMatrix ret;
+            size_t step = AlignedStep<T>(cols * channels);
+            // page-aligned slots keep the rows as aligned as AlignedMalloc would
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t offset = (sizeof(ShmHeader) + page - 1) / page * page;
+            size_t slot_bytes = (rows * step * sizeof(T) + page - 1) / page * page;
+            ret.segment = ShmRegistry::instance().create(name, offset + slots * slot_bytes, replace);
+            if (!ret.segment && !replace && stale(name))
+                ret.segment = ShmRegistry::instance().create(name, offset + slots * slot_bytes, true);
+            if (!ret.segment)
+                return ret;
+            ShmHeader *h = new (ret.segment->base) ShmHeader;
+            h->elem_size = sizeof(T);
+            h->rows = rows;
+            h->cols = cols;
+            h->channels = channels;
+            h->step = step;
+            h->slots = slots;
+            h->slot_bytes = slot_bytes;
+            h->data_offset = offset;
+            h->frames.store(0, std::memory_order_relaxed);
+            for (auto &s : h->seq)
+                s.store(0, std::memory_order_relaxed);
+            h->magic.store(ShmHeader::MAGIC, std::memory_order_release);
+            ret.header = h;
+            ret.writer = true;
+            ret.rows = rows;
+            ret.cols = cols;
+            ret.channels = channels;
+            return ret;
+        }
+
+        // maps the segment name read-only, not good() if it does not exist yet, holds another element type or its
+        // header does not describe a layout this process can read
+        static SharedMatrix attach(const std::string &name)
+        {
+            SharedMatrix ret;
+            auto seg = ShmRegistry::instance().attach(name);
+            if (!seg || seg->bytes < sizeof(ShmHeader))
+                return ret;
+            ShmHeader *h = (ShmHeader *)seg->base;
+            if (h->magic.load(std::memory_order_acquire) != ShmHeader::MAGIC || h->elem_size != sizeof(T))
+                return ret;
+            // slots is a modulus and indexes seq, the views assume the step of AlignedStep
+            if (h->slots == 0 || h->slots > ShmHeader::MAX_SLOTS || h->step != AlignedStep<T>(h->cols * h->channels) ||
+                h->slot_bytes < h->rows * h->step * sizeof(T) || h->data_offset < sizeof(ShmHeader) ||
+                h->data_offset > seg->bytes || h->slot_bytes > (seg->bytes - h->data_offset) / h->slots)
+                return ret;
+            ret.segment = seg;
+            ret.header = h;
+            ret.rows = h->rows;
+            ret.cols = h->cols;
+            ret.channels = h->channels;
+            return ret;
+        }
+
+        bool good() const { return this->header != nullptr; }
+
+        // writable view of the slot of the next frame, filled in place and published by endWrite
+        Matrix<T> beginWrite()
+        {
+            assert(this->writer && this->writing == 0);
+            ShmHeader *h = this->header;
+            this->writing = h->frames.load(std::memory_order_relaxed) + 1;
+            std::atomic<uint64_t> &seq = h->seq[(this->writing - 1) % h->slots];
+            seq.store(2 * this->writing - 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return Matrix<T>::wrap(this->rows, this->cols, this->channels, this->slot(this->writing));
+        }
+
+        void endWrite()
+        {
+            assert(this->writer && this->writing != 0);
+            ShmHeader *h = this->header;
+            h->seq[(this->writing - 1) % h->slots].store(2 * this->writing, std::memory_order_release);
+            h->frames.store(this->writing, std::memory_order_release);
+            this->writing = 0;
+        }
+
+        // copies m into the next slot and publishes it
+        void publish(const Matrix<T> &m)
+        {
+            assert(m.rows == this->rows && m.cols == this->cols && m.channels == this->channels);
+            Matrix<T> dst = this->beginWrite();
+            memcpy(dst.data(), m.data(), dst.size);
+            this->endWrite();
+        }
+
+        // view of the latest complete frame, returns its number or 0 if nothing was published yet. the view reads
+        // the slot in place and copies it on the first write, the slot stays intact while valid() holds for the frame
+        uint64_t latest(Matrix<T> &view) const
+        {
+            const ShmHeader *h = this->header;
+            for (;;)
+            {
+                uint64_t f = h->frames.load(std::memory_order_acquire);
+                if (f == 0)
+                    return 0;
+                // the writer may have moved on to this slot again, then the next frame is complete
+                if (h->seq[(f - 1) % h->slots].load(std::memory_order_acquire) == 2 * f)
+                {
+                    view = Matrix<T>::wrapReadOnly(this->rows, this->cols, this->channels, this->slot(f));
+                    return f;
+                }
+            }
+        }
+
+        // true while the slot of frame f still holds it, check after reading a view to know the reads were complete
+        bool valid(uint64_t f) const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const ShmHeader *h = this->header;
+            return f != 0 && h->seq[(f - 1) % h->slots].load(std::memory_order_relaxed) == 2 * f;
+        }
+
+        // copies the latest complete frame into dst, returns its number or 0 if nothing was published yet
+        uint64_t read(Matrix<T> &dst) const
+        {
+            if (dst.rows != this->rows || dst.cols != this->cols || dst.channels != this->channels)
+                dst.create(this->rows, this->cols, this->channels);
+            for (;;)
+            {
+                Matrix<T> view;
+                uint64_t f = this->latest(view);
+                if (f == 0)
+                    return 0;
+                memcpy(dst.data(), view.data(), dst.size);
+                if (this->valid(f))
+                    return f;
+            }
+        }
+
+    private:
+        std::shared_ptr<ShmSegment> segment;
+
+        // the object named name exists but its creator never finished the header
+        static bool stale(const std::string &name)
+        {
+            ShmSegment probe(name, 0, false);
+            if (probe.good())
+                return probe.bytes < sizeof(ShmHeader) || ((const ShmHeader *)probe.base)->magic.load(std::memory_order_acquire) != ShmHeader::MAGIC;
+            // an empty object cannot be mapped, its creator stopped before sizing it
+            int fd = shm_open(probe.name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            bool empty = fstat(fd, &st) == 0 && st.st_size == 0;
+            ::close(fd);
+            return empty;
+        }
+        ShmHeader *header = nullptr;
+        bool writer = false;
+        uint64_t writing = 0; // frame between beginWrite and endWrite
+
+        T *slot(uint64_t f) const
+        {
+            const ShmHeader *h = this->header;
+            return (T *)((char *)this->segment->base + h->data_offset + (f - 1) % h->slots * h->slot_bytes);
+        }
+    };
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "matrix.h"
+
+#ifndef FKZQ_SPMM_BLOCK
+#define FKZQ_SPMM_BLOCK 512 // output columns the sparse x dense product accumulates at once, kept in L1
+#endif
+
+namespace fkZQ
+{
+    // coordinate list for building sparse matrices, entries may come in any order and repeat (repeats are summed
+    // when converted to CSR)
+    template <typename T>
+    class CooMatrix
+    {
+    public:
+        size_t rows, cols;
+        std::vector<unsigned int> rowind, colind;
+        std::vector<T> values;
+        CooMatrix();
+        CooMatrix(size_t _rows, size_t _cols);
+        void reserve(size_t nnz);
+        void add(size_t row, size_t col, const T &value);
+        size_t nnz() const;
+    };
+
+    // compressed sparse rows: the entries of row i are colind/values[rowptr[i], rowptr[i + 1]), sorted by column
+    // and without repeats. indices are 32 bit, rowptr is not, so only the dimensions are limited to 2^32
+    template <typename T>
+    class CsrMatrix
+    {
+    public:
+        size_t rows, cols;
+        std::vector<size_t> rowptr;
+        std::vector<unsigned int> colind;
+        std::vector<T> values;
+        CsrMatrix();
+        CsrMatrix(size_t _rows, size_t _cols); // all zero
+        explicit CsrMatrix(const CooMatrix<T> &coo);
+        explicit CsrMatrix(const Matrix<T> &dense); // keeps the non-zero elements of a single-channel matrix
+
+        size_t nnz() const;
+        Matrix<T> toDense() const;
+        CooMatrix<T> toCoo() const;
+        CsrMatrix<T> transpose() const; // counting sort over the columns, O(nnz + rows + cols)
+
+        // y[0:rows] = this * x[0:cols]
+        void gemv(const T *x, T *y) const;
+        // this * x for a row or column vector x, the result has the orientation of x
+        Matrix<T> gemv(const Matrix<T> &x) const;
+        // this * b for a dense cols x n matrix b
+        Matrix<T> operator*(const Matrix<T> &b) const;
+
+    private:
+        // first row of part t of nt, the parts hold about the same number of entries
+        size_t partition(size_t t, size_t nt) const;
+    };
+}
@@ -0,0 +1,336 @@
+#pragma once
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <omp.h>
+#include "sparse.h"
+
+namespace fkZQ
+{
+    template <typename T>
+    CooMatrix<T>::CooMatrix() : rows(0), cols(0) {}
+    template <typename T>
+    CooMatrix<T>::CooMatrix(size_t _rows, size_t _cols) : rows(_rows), cols(_cols)
+    {
+        assert(_rows <= 0xffffffffull && _cols <= 0xffffffffull);
+    }
+    template <typename T>
+    void CooMatrix<T>::reserve(size_t nnz)
+    {
+        this->rowind.reserve(nnz);
+        this->colind.reserve(nnz);
+        this->values.reserve(nnz);
+    }
+    template <typename T>
+    void CooMatrix<T>::add(size_t row, size_t col, const T &value)
+    {
+        assert(row < this->rows && col < this->cols);
+        this->rowind.push_back((unsigned int)row);
+        this->colind.push_back((unsigned int)col);
+        this->values.push_back(value);
+    }
+    template <typename T>
+    size_t CooMatrix<T>::nnz() const { return this->values.size(); }
+
+    template <typename T>
+    CsrMatrix<T>::CsrMatrix() : rows(0), cols(0), rowptr(1, 0) {}
+    template <typename T>
+    CsrMatrix<T>::CsrMatrix(size_t _rows, size_t _cols) : rows(_rows), cols(_cols), rowptr(_rows + 1, 0)
+    {
+        assert(_rows <= 0xffffffffull && _cols <= 0xffffffffull);
+    }
+    template <typename T>
+    CsrMatrix<T>::CsrMatrix(const CooMatrix<T> &coo) : CsrMatrix(coo.rows, coo.cols)
+    {
+        size_t nnz = coo.nnz();
+        // bucket the entries by row
+        for (size_t k = 0; k < nnz; ++k)
+        {
+            ++this->rowptr[coo.rowind[k] + 1];
+        }
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            this->rowptr[i + 1] += this->rowptr[i];
+        }
+        this->colind.resize(nnz);
+        this->values.resize(nnz);
+        std::vector<size_t> next(this->rowptr.begin(), this->rowptr.end() - 1);
+        for (size_t k = 0; k < nnz; ++k)
+        {
+            size_t p = next[coo.rowind[k]]++;
+            this->colind[p] = coo.colind[k];
+            this->values[p] = coo.values[k];
+        }
+        // sort every row by column and sum the repeats, then close the gaps they leave
+        std::vector<size_t> count(this->rows);
+#pragma omp parallel if (nnz >= FKZQ_PARALLEL_THRESHOLD)
+        {
+            std::vector<std::pair<unsigned int, T>> row;
+#pragma omp for schedule(dynamic, 256)
+            for (long i = 0; i < (long)this->rows; ++i)
+            {
+                size_t b = this->rowptr[i], e = this->rowptr[i + 1];
+                row.clear();
+                for (size_t k = b; k < e; ++k)
+                {
+                    row.emplace_back(this->colind[k], this->values[k]);
+                }
+                std::sort(row.begin(), row.end(), [](const auto &x, const auto &y) { return x.first < y.first; });
+                size_t p = b;
+                for (size_t k = 0; k < row.size(); ++k)
+                {
+                    if (p > b && this->colind[p - 1] == row[k].first)
+                    {
+                        this->values[p - 1] += row[k].second;
+                        continue;
+                    }
+                    this->colind[p] = row[k].first;
+                    this->values[p] = row[k].second;
+                    ++p;
+                }
+                count[i] = p - b;
+            }
+        }
+        size_t p = 0;
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            size_t b = this->rowptr[i];
+            if (p != b)
+            {
+                std::copy(this->colind.begin() + b, this->colind.begin() + b + count[i], this->colind.begin() + p);
+                std::copy(this->values.begin() + b, this->values.begin() + b + count[i], this->values.begin() + p);
+            }
+            this->rowptr[i] = p;
+            p += count[i];
+        }
+        this->rowptr[this->rows] = p;
+        this->colind.resize(p);
+        this->values.resize(p);
+    }
+    template <typename T>
+    CsrMatrix<T>::CsrMatrix(const Matrix<T> &dense) : CsrMatrix(dense.rows, dense.cols)
+    {
+        assert(dense.channels == 1);
+        const T *d = dense.data();
+        bool parallel = this->rows * this->cols >= FKZQ_PARALLEL_THRESHOLD;
+#pragma omp parallel for schedule(static) if (parallel)
+        for (long i = 0; i < (long)this->rows; ++i)
+        {
+            const T *row = d + i * dense.step;
+            size_t n = 0;
+            for (size_t j = 0; j < this->cols; ++j)
+            {
+                n += row[j] != T(0);
+            }
+            this->rowptr[i + 1] = n;
+        }
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            this->rowptr[i + 1] += this->rowptr[i];
+        }
+        this->colind.resize(this->rowptr[this->rows]);
+        this->values.resize(this->rowptr[this->rows]);
+#pragma omp parallel for schedule(static) if (parallel)
+        for (long i = 0; i < (long)this->rows; ++i)
+        {
+            const T *row = d + i * dense.step;
+            size_t p = this->rowptr[i];
+            for (size_t j = 0; j < this->cols; ++j)
+            {
+                if (row[j] != T(0))
+                {
+                    this->colind[p] = (unsigned int)j;
+                    this->values[p++] = row[j];
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    size_t CsrMatrix<T>::nnz() const { return this->rowptr[this->rows]; }
+
+    template <typename T>
+    size_t CsrMatrix<T>::partition(size_t t, size_t nt) const
+    {
+        if (t >= nt)
+            return this->rows;
+        size_t target = this->nnz() * t / nt;
+        return std::lower_bound(this->rowptr.begin(), this->rowptr.end() - 1, target) - this->rowptr.begin();
+    }
+
+    template <typename T>
+    Matrix<T> CsrMatrix<T>::toDense() const
+    {
+        Matrix<T> ret(this->rows, this->cols);
+        T *d = ret.data();
+#pragma omp parallel for schedule(static) if (this->rows * this->cols >= FKZQ_PARALLEL_THRESHOLD)
+        for (long i = 0; i < (long)this->rows; ++i)
+        {
+            T *row = d + i * ret.step;
+            for (size_t k = this->rowptr[i]; k < this->rowptr[i + 1]; ++k)
+            {
+                row[this->colind[k]] = this->values[k];
+            }
+        }
+        return ret;
+    }
+
+    template <typename T>
+    CooMatrix<T> CsrMatrix<T>::toCoo() const
+    {
+        CooMatrix<T> ret(this->rows, this->cols);
+        ret.rowind.resize(this->nnz());
+        ret.colind = this->colind;
+        ret.values = this->values;
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            std::fill(ret.rowind.begin() + this->rowptr[i], ret.rowind.begin() + this->rowptr[i + 1], (unsigned int)i);
+        }
+        return ret;
+    }
+
+    template <typename T>
+    CsrMatrix<T> CsrMatrix<T>::transpose() const
+    {
+        CsrMatrix<T> ret(this->cols, this->rows);
+        size_t nnz = this->nnz();
+        for (size_t k = 0; k < nnz; ++k)
+        {
+            ++ret.rowptr[this->colind[k] + 1];
+        }
+        for (size_t j = 0; j < this->cols; ++j)
+        {
+            ret.rowptr[j + 1] += ret.rowptr[j];
+        }
+        ret.colind.resize(nnz);
+        ret.values.resize(nnz);
+        // rows are visited in order, so every transposed row comes out sorted
+        std::vector<size_t> next(ret.rowptr.begin(), ret.rowptr.end() - 1);
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            for (size_t k = this->rowptr[i]; k < this->rowptr[i + 1]; ++k)
+            {
+                size_t p = next[this->colind[k]]++;
+                ret.colind[p] = (unsigned int)i;
+                ret.values[p] = this->values[k];
+            }
+        }
+        return ret;
+    }
+
+    template <typename T>
+    void CsrMatrix<T>::gemv(const T *x, T *y) const
+    {
+        int threads = this->nnz() >= FKZQ_PARALLEL_THRESHOLD ? omp_get_max_threads() : 1;
+        const size_t *rp = this->rowptr.data();
+        const unsigned int *ci = this->colind.data();
+        const T *v = this->values.data();
+#pragma omp parallel num_threads(threads)
+        {
+            int nt = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            size_t i1 = this->partition(t + 1, nt);
+            for (size_t i = this->partition(t, nt); i < i1; ++i)
+            {
+                // four independent sums hide the latency of the gathered loads
+                T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+                size_t k = rp[i], e = rp[i + 1];
+                for (; k + 4 <= e; k += 4)
+                {
+                    s0 += v[k] * x[ci[k]];
+                    s1 += v[k + 1] * x[ci[k + 1]];
+                    s2 += v[k + 2] * x[ci[k + 2]];
+                    s3 += v[k + 3] * x[ci[k + 3]];
+                }
+                for (; k < e; ++k)
+                {
+                    s0 += v[k] * x[ci[k]];
+                }
+                y[i] = (s0 + s1) + (s2 + s3);
+            }
+        }
+    }
+
+    template <typename T>
+    Matrix<T> CsrMatrix<T>::gemv(const Matrix<T> &x) const
+    {
+        assert(x.channels == 1);
+        assert((x.rows == 1 || x.cols == 1) && x.rows * x.cols == this->cols);
+        Matrix<T> ret = x.rows == 1 ? Matrix<T>(1, this->rows) : Matrix<T>(this->rows, 1);
+        if (x.rows == 1)
+        {
+            this->gemv(x.data(), ret.data());
+            return ret;
+        }
+        // a column vector keeps one element per padded row, gather it first and scatter the result
+        T *xbuf = (T *)AlignedMalloc<T>(this->cols * sizeof(T), false);
+        T *ybuf = (T *)AlignedMalloc<T>(this->rows * sizeof(T), false);
+        const T *xd = x.data();
+        for (size_t i = 0; i < this->cols; ++i)
+        {
+            xbuf[i] = xd[i * x.step];
+        }
+        this->gemv(xbuf, ybuf);
+        T *yd = ret.data();
+        for (size_t i = 0; i < this->rows; ++i)
+        {
+            yd[i * ret.step] = ybuf[i];
+        }
+        AlignedFree(xbuf);
+        AlignedFree(ybuf);
+        return ret;
+    }
+
+    template <typename T>
+    Matrix<T> CsrMatrix<T>::operator*(const Matrix<T> &b) const
+    {
+        assert(b.channels == 1 && b.rows == this->cols);
+        if (b.cols == 1)
+        {
+            return this->gemv(b);
+        }
+        size_t n = b.cols;
+        Matrix<T> ret(this->rows, n);
+        const T *bd = b.data();
+        T *cd = ret.data();
+        int threads = this->nnz() * n >= FKZQ_PARALLEL_THRESHOLD ? omp_get_max_threads() : 1;
+#pragma omp parallel num_threads(threads)
+        {
+            int nt = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            size_t i1 = this->partition(t + 1, nt);
+            for (size_t i = this->partition(t, nt); i < i1; ++i)
+            {
+                size_t kb = this->rowptr[i], ke = this->rowptr[i + 1];
+                T *c = cd + i * ret.step;
+                // c(i, :) = sum_k a(i, k) b(k, :), one block of columns at a time so it stays in L1 across the entries
+                for (size_t j0 = 0; j0 < n; j0 += FKZQ_SPMM_BLOCK)
+                {
+                    size_t j1 = std::min<size_t>(n, j0 + FKZQ_SPMM_BLOCK);
+                    for (size_t k = kb; k < ke; ++k)
+                    {
+                        const T *brow = bd + this->colind[k] * b.step;
+                        T a = this->values[k];
+                        size_t j = j0;
+#ifdef _FKZQ_USE_SIMD
+                        constexpr size_t W = simd<T>::size();
+                        simd<T> av = a;
+                        for (; j + W <= j1; j += W)
+                        {
+                            simd<T> cv(c + j, stdx::vector_aligned);
+                            cv += av * simd<T>(brow + j, stdx::vector_aligned);
+                            cv.copy_to(c + j, stdx::vector_aligned);
+                        }
+#endif
+                        for (; j < j1; ++j)
+                        {
+                            c[j] += a * brow[j];
+                        }
+                    }
+                }
+            }
+        }
+        return ret;
+    }
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include <cassert>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include "matrix.h"
+#include "boxfilter.hpp"
+
+#ifndef FKZQ_TASK_THREADS
+#define FKZQ_TASK_THREADS 0 // workers of the task graph pool, 0 for one per hardware thread
+#endif
+
+namespace fkZQ
+{
+    // fixed set of workers running queued jobs in FIFO order. every worker limits OpenMP to one thread, so the
+    // kernels called from a job run serially and the parallelism comes from running independent jobs at once
+    class ThreadPool
+    {
+    public:
+        static ThreadPool &instance()
+        {
+            static ThreadPool pool(FKZQ_TASK_THREADS > 0 ? FKZQ_TASK_THREADS : std::max(1u, std::thread::hardware_concurrency()));
+            return pool;
+        }
+
+        explicit ThreadPool(size_t threads)
+        {
+            for (size_t i = 0; i < threads; ++i)
+            {
+                this->workers.emplace_back([this]
+                                           {
+                    omp_set_num_threads(1);
+                    for (;;)
+                    {
+                        std::function<void()> job;
+                        {
+                            std::unique_lock<std::mutex> guard(this->lock);
+                            this->ready.wait(guard, [this] { return this->stop || !this->jobs.empty(); });
+                            if (this->jobs.empty())
+                                return;
+                            job = std::move(this->jobs.front());
+                            this->jobs.pop_front();
+                        }
+                        job();
+                    } });
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->stop = true;
+            }
+            this->ready.notify_all();
+            for (auto &w : this->workers)
+            {
+                w.join();
+            }
+        }
+
+        void submit(std::function<void()> job)
+        {
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->jobs.push_back(std::move(job));
+            }
+            this->ready.notify_one();
+        }
+
+        size_t size() const { return this->workers.size(); }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        std::mutex lock;
+        std::condition_variable ready;
+        bool stop = false;
+    };
+
+    class TaskGraph;
+
+    struct TaskNode
+    {
+        std::vector<std::shared_ptr<TaskNode>> producers;
+        std::vector<TaskNode *> consumers;
+        std::atomic<size_t> waiting{0}; // producers not finished yet
+        std::atomic<size_t> users{0};   // consumers not finished yet
+        bool keep = false;              // result survives its consumers
+        virtual ~TaskNode() = default;
+        virtual void execute() = 0;
+        virtual void release() = 0;
+    };
+
+    template <typename R>
+    struct TaskValue : TaskNode
+    {
+        std::function<R()> fn;
+        std::optional<R> value;
+        void execute() override
+        {
+            this->value.emplace(this->fn());
+            this->fn = nullptr; // drops what the closure captured
+        }
+        void release() override { this->value.reset(); }
+    };
+
+    // handle to the result of one node of a TaskGraph, valid once the graph has been waited for
+    template <typename R>
+    class Task
+    {
+    public:
+        Task() = default;
+        // keeps the result alive after its last consumer finished; nodes without consumers always keep it
+        Task<R> &keep()
+        {
+            this->node->keep = true;
+            return *this;
+        }
+        const R &get() const
+        {
+            assert(this->node && this->node->value && "result released or graph not finished");
+            return *this->node->value;
+        }
+
+    private:
+        std::shared_ptr<TaskValue<R>> node;
+        friend class TaskGraph;
+    };
+
+    // dependency DAG of operations. add() only records a node; run() starts every node whose inputs are ready on
+    // the shared ThreadPool, and each finished node starts the consumers it was the last input of. the result of a
+    // node is freed as soon as its last consumer finished unless it was kept, so intermediate matrices do not
+    // outlive their use. wait() must not be called from a job of the pool
+    class TaskGraph
+    {
+    public:
+        TaskGraph(ThreadPool &_pool = ThreadPool::instance()) : pool(_pool) {}
+        TaskGraph(const TaskGraph &) = delete;
+        TaskGraph &operator=(const TaskGraph &) = delete;
+        ~TaskGraph()
+        {
+            if (this->started)
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->done.wait(guard, [this] { return this->remaining == 0; });
+            }
+        }
+
+        // node holding a value known up front
+        template <typename R>
+        Task<R> input(R value)
+        {
+            auto node = std::make_shared<TaskValue<R>>();
+            node->fn = [v = std::move(value)]() mutable { return std::move(v); };
+            return this->record(node);
+        }
+
+        // node computing f(deps.get()...) once every dependency is done
+        template <typename F, typename... D>
+        auto add(F f, const Task<D> &...deps)
+        {
+            using R = std::decay_t<std::invoke_result_t<F, const D &...>>;
+            assert(!this->started);
+            auto node = std::make_shared<TaskValue<R>>();
+            node->fn = [f = std::move(f), deps...]() mutable { return f(deps.get()...); };
+            (this->link(deps.node, node.get()), ...);
+            return this->record(node);
+        }
+
+        void run()
+        {
+            assert(!this->started);
+            this->started = true;
+            this->remaining = this->nodes.size();
+            for (auto &n : this->nodes)
+            {
+                n->waiting = n->producers.size();
+                n->users = n->consumers.size();
+                n->keep = n->keep || n->consumers.empty();
+            }
+            if (this->nodes.empty())
+                return;
+            for (auto &n : this->nodes)
+            {
+                if (n->producers.empty())
+                    this->schedule(n.get());
+            }
+        }
+
+        // runs the graph if needed and blocks until every node finished, rethrows the first exception a node threw
+        void wait()
+        {
+            if (!this->started)
+                this->run();
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->done.wait(guard, [this] { return this->remaining == 0; });
+            if (this->error)
+                std::rethrow_exception(this->error);
+        }
+
+    private:
+        ThreadPool &pool;
+        std::vector<std::shared_ptr<TaskNode>> nodes;
+        bool started = false;
+        size_t remaining = 0;
+        std::exception_ptr error;
+        std::mutex lock;
+        std::condition_variable done;
+
+        template <typename R>
+        Task<R> record(const std::shared_ptr<TaskValue<R>> &node)
+        {
+            this->nodes.push_back(node);
+            Task<R> t;
+            t.node = node;
+            return t;
+        }
+
+        void link(const std::shared_ptr<TaskNode> &producer, TaskNode *consumer)
+        {
+            assert(producer && "dependency from another graph or empty handle");
+            consumer->producers.push_back(producer);
+            producer->consumers.push_back(consumer);
+        }
+
+        void schedule(TaskNode *n)
+        {
+            this->pool.submit([this, n]
+                              {
+                bool failed;
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    failed = this->error != nullptr;
+                }
+                // after a failure the remaining nodes are only counted down, their inputs may be missing
+                try
+                {
+                    if (!failed)
+                        n->execute();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    if (!this->error)
+                        this->error = std::current_exception();
+                }
+                for (auto &p : n->producers)
+                {
+                    if (p->users.fetch_sub(1) == 1 && !p->keep)
+                        p->release();
+                }
+                for (TaskNode *c : n->consumers)
+                {
+                    if (c->waiting.fetch_sub(1) == 1)
+                        this->schedule(c);
+                }
+                std::lock_guard<std::mutex> guard(this->lock);
+                if (--this->remaining == 0)
+                    this->done.notify_all(); });
+        }
+    };
+
+    // task versions of the blocking operations, the inputs are shared with the graph until their consumers finish
+    template <typename U, typename T>
+    Task<Matrix<U>> asyncToType(TaskGraph &g, const Task<Matrix<T>> &a)
+    {
+        return g.add([](const Matrix<T> &m) { return toType<U>(m); }, a);
+    }
+
+    template <typename ST, typename IT>
+    Task<Matrix<ST>> asyncBoxFilter(TaskGraph &g, const Task<Matrix<IT>> &a, int k_size)
+    {
+        return g.add([k_size](const Matrix<IT> &m)
+                     {
+                         Matrix<ST> ret;
+                         box_filter_s(m, ret, k_size);
+                         return ret; },
+                     a);
+    }
+
+    template <typename T>
+    Task<Matrix<T>> asyncAdd(TaskGraph &g, const Task<Matrix<T>> &a, const Task<Matrix<T>> &b)
+    {
+        return g.add([](Matrix<T> x, const Matrix<T> &y) { return x + y; }, a, b);
+    }
+
+    template <typename T>
+    Task<Matrix<T>> asyncSub(TaskGraph &g, const Task<Matrix<T>> &a, const Task<Matrix<T>> &b)
+    {
+        return g.add([](Matrix<T> x, const Matrix<T> &y) { return x - y; }, a, b);
+    }
+
+    // matrix product
+    template <typename T>
+    Task<Matrix<T>> asyncMultiply(TaskGraph &g, const Task<Matrix<T>> &a, const Task<Matrix<T>> &b)
+    {
+        return g.add([](Matrix<T> x, const Matrix<T> &y) { return x * y; }, a, b);
+    }
+}
@@ -34,12 +34,13 @@ cv::Mat toCvMat(const fkZQ::Matrix<T> &mat)
         std::cerr << "Unsupported type" << std::endl;
         return cv::Mat();
     }
-    cv::Mat ret(mat.rows, mat.cols, type);
+    cv::Mat ret(mat.rows, mat.cols, CV_MAKETYPE(type, (int)mat.channels));
     for (int i = 0; i < mat.rows; ++i)
     {
-        for (int j = 0; j < mat.cols; ++j)
+        T *row = ret.ptr<T>(i);
+        for (int j = 0; j < mat.cols * mat.channels; ++j)
         {
-            ret.at<T>(i, j) = mat.at(i, j);
+            row[j] = mat.at(i, j);
         }
     }
     return ret;
@@ -52,7 +53,7 @@ float compare(const cv::Mat &cvMat, const fkZQ::Matrix<T> &mat)
     cv::Mat diff;
     cv::absdiff(cvMat, cvMat2, diff);
     cv::Scalar s = cv::sum(diff);
-    return s[0] / (cvMat.rows * cvMat.cols);
+    return (s[0] + s[1] + s[2] + s[3]) / (cvMat.rows * cvMat.cols * cvMat.channels());
 }
 
 #define assert_eq(cvMat, mat)                                                                                \
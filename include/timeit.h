@@ -32,8 +32,14 @@
 
 #define TIMEIT_PRINT(id, tab_num, n) \
     std::cout << std::string(tab_num, '\t') << #id << " Time taken: " << timeit_duration_##id.count() * 1000 << " ms" << std::string(n + 1, '\n');
+
+#define TIMEIT_PRINT_BW(id, tab_num, n, bytes, peak)                                                           \
+    std::cout << std::string(tab_num, '\t') << #id << " Time taken: " << timeit_duration_##id.count() * 1000 << " ms, " \
+              << (bytes) / timeit_duration_##id.count() / 1e9 << " GB/s ("                                     \
+              << 100 * (bytes) / timeit_duration_##id.count() / 1e9 / (peak) << "% of peak)" << std::string(n + 1, '\n');
 #else
 #define TIMEIT_BEGIN(id) {}
 #define TIMEIT_END(id) {}
 #define TIMEIT_PRINT(id, tab_num, n) {}
+#define TIMEIT_PRINT_BW(id, tab_num, n, bytes, peak) {}
 #endif
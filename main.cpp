@@ -5,11 +5,26 @@
 #include <opencv2/core/core.hpp>
 
 #include "matrix.h"
+#include "gemm.hpp"
+#include "elementwise.hpp"
+#include "linalg.hpp"
 #include "boxfilter.hpp"
+#include "channels.hpp"
+#include "resize.hpp"
+#include "fft.hpp"
+#include "simd_math.hpp"
+#include "broadcast.hpp"
+#include "sparse.h"
+#include "taskgraph.hpp"
+#include "outofcore.hpp"
+#include "shm.hpp"
+#include "chain.hpp"
+#include "batch.hpp"
 
 #include "timeit.h"
 #include "test_helper.hpp"
 #include <vector>
+#include <filesystem>
 #define DEFAULT_ROWS 1024
 #define DEFAULT_COLS 1280
 
@@ -19,6 +34,24 @@ fkZQ::Matrix<T> FixedMatrix()
     return fkZQ::Matrix<T>(_rows, _cols);
 }
 
+// STREAM-like copy bandwidth (bytes read + written) over buffers well beyond the last level cache, in GB/s
+double StreamCopyPeak()
+{
+    size_t n = 4 * fkZQ::LastLevelCacheSize() / sizeof(float);
+    std::vector<float> a(n, 1.0f), b(n, 0.0f);
+    double best = 0;
+    for (int rep = 0; rep < 5; ++rep)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+#pragma omp parallel for schedule(static)
+        for (long i = 0; i < (long)n; ++i)
+            b[i] = a[i];
+        std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+        best = std::max(best, 2.0 * n * sizeof(float) / duration.count() / 1e9);
+    }
+    return best;
+}
+
 int main(int argc, char const *argv[])
 {
     size_t ROWS = DEFAULT_ROWS, COLS = DEFAULT_COLS;
@@ -27,6 +60,9 @@ int main(int argc, char const *argv[])
         ROWS = std::atoi(argv[1]);
         COLS = std::atoi(argv[2]);
     }
+    // kernel parameters in effect, from the tune target's config if there is one
+    std::cout << "kernel parameters: " << (fkZQ::Params().source.empty() ? "defaults" : fkZQ::Params().source) << std::endl;
+    fkZQ::Params().print(std::cout);
     cv::Mat cvmatab(ROWS, COLS, CV_32F);
     cv::Mat cvmataa(ROWS, ROWS, CV_32F);
     cv::Mat cvmatba(COLS, ROWS, CV_32F);
@@ -56,6 +92,28 @@ int main(int argc, char const *argv[])
     assert_eq(cvmatab, pmatab);
     assert_eq(cvmataa, pmataa);
     assert_eq(cvmatba, pmatba);
+    std::cout << "huge-page backed: " << fkZQ::HugePageBytes() / (1 << 20) << " MB advised, "
+              << fkZQ::HugePageResidentBytes() / (1 << 20) << " MB resident" << std::endl;
+
+    double peak = StreamCopyPeak();
+    double bytes3 = 3.0 * ROWS * COLS * sizeof(float); // two operands read, one result written
+    double bytes2 = 2.0 * ROWS * COLS * sizeof(float);
+    std::cout << "STREAM-like copy peak: " << peak << " GB/s, streaming stores above " << fkZQ::StreamingThreshold() / (1 << 20)
+              << " MB" << std::endl;
+
+    TIMEIT_BEGIN(fkZQ_copy);
+    fkZQ::Matrix<float> pcopy = pmatab;
+    TIMEIT_END(fkZQ_copy);
+    TIMEIT_PRINT(fkZQ_copy, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_clone);
+    fkZQ::Matrix<float> pclone = pmatab.clone();
+    TIMEIT_END(fkZQ_clone);
+    TIMEIT_PRINT(fkZQ_clone, 0, 0);
+
+    pcopy.at(0, 0) += 1; // detaches pcopy, pmatab is unchanged
+    assert_eq(cvmatab, pmatab);
+    assert_eq(cvmatab, pclone);
 
     TIMEIT_BEGIN(cv_add);
     cv::Mat cvadd = cvmatab + cvmatab;
@@ -65,10 +123,34 @@ int main(int argc, char const *argv[])
     TIMEIT_BEGIN(fkZQ_add);
     fkZQ::Matrix<float> padd = pmatab + pmatab;
     TIMEIT_END(fkZQ_add);
-    TIMEIT_PRINT(fkZQ_add, 0, 0);
+    TIMEIT_PRINT_BW(fkZQ_add, 0, 0, bytes3, peak);
 
     assert_eq(cvadd, padd);
 
+    TIMEIT_BEGIN(cv_sub);
+    cv::Mat cvsub = cvadd - cvmatab;
+    TIMEIT_END(cv_sub);
+    TIMEIT_PRINT(cv_sub, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_sub);
+    fkZQ::Matrix<float> psub = padd - pmatab;
+    TIMEIT_END(fkZQ_sub);
+    TIMEIT_PRINT_BW(fkZQ_sub, 0, 0, bytes3, peak);
+
+    assert_eq(cvsub, psub);
+
+    TIMEIT_BEGIN(cv_scale);
+    cv::Mat cvscale = cvmatab * 0.5;
+    TIMEIT_END(cv_scale);
+    TIMEIT_PRINT(cv_scale, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_scale);
+    fkZQ::Matrix<float> pscale = pmatab * 0.5f;
+    TIMEIT_END(fkZQ_scale);
+    TIMEIT_PRINT_BW(fkZQ_scale, 0, 0, bytes2, peak);
+
+    assert_eq(cvscale, pscale);
+
     TIMEIT_BEGIN(cv_mul);
     cv::Mat cvmul = cvmataa.mul(cvmataa);
     TIMEIT_END(cv_mul);
@@ -77,7 +159,7 @@ int main(int argc, char const *argv[])
     TIMEIT_BEGIN(fkZQ_mul);
     fkZQ::Matrix<float> pmul = pmataa.mul(pmataa);
     TIMEIT_END(fkZQ_mul);
-    TIMEIT_PRINT(fkZQ_mul, 0, 0);
+    TIMEIT_PRINT_BW(fkZQ_mul, 0, 0, 3.0 * ROWS * ROWS * sizeof(float), peak);
 
     assert_eq(cvmul, pmul);
 
@@ -93,6 +175,138 @@ int main(int argc, char const *argv[])
 
     assert_eq(cvmatmul, pmatmul);
 
+    // the same product with one Strassen-Winograd level, enabled for floats around this call only
+    size_t &pstrassenthreshold = fkZQ::Params().strassen[fkZQ::TypeClass(sizeof(float))];
+    size_t pstrassenprevious = pstrassenthreshold;
+    pstrassenthreshold = std::min(ROWS, COLS);
+    TIMEIT_BEGIN(fkZQ_strassen);
+    fkZQ::Matrix<float> pstrassen = pmatab * pmatba;
+    TIMEIT_END(fkZQ_strassen);
+    TIMEIT_PRINT(fkZQ_strassen, 0, 0);
+    pstrassenthreshold = pstrassenprevious;
+
+    assert_eq(cvmatmul, pstrassen);
+    double strassendiff = 0, strassennorm = 0;
+    for (size_t i = 0; i < ROWS; ++i)
+    {
+        const float *ps = pstrassen.ptr(i), *pc = pmatmul.ptr(i);
+        for (size_t j = 0; j < ROWS; ++j)
+        {
+            strassendiff += ((double)ps[j] - pc[j]) * ((double)ps[j] - pc[j]);
+            strassennorm += (double)pc[j] * pc[j];
+        }
+    }
+    std::cout << "strassen error relative to gemm " << std::sqrt(strassendiff / strassennorm) << std::endl;
+
+    cv::Mat cvvec(COLS, 1, CV_32F);
+    cv::Mat cvvec_t(ROWS, 1, CV_32F);
+    cv::randu(cvvec, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::randu(cvvec_t, cv::Scalar::all(0), cv::Scalar::all(1));
+    fkZQ::Matrix<float> pvec(COLS, 1);
+    fkZQ::Matrix<float> pvec_t(ROWS, 1);
+    for (int i = 0; i < COLS; ++i)
+        pvec.at(i, 0) = cvvec.at<float>(i, 0);
+    for (int i = 0; i < ROWS; ++i)
+        pvec_t.at(i, 0) = cvvec_t.at<float>(i, 0);
+
+    TIMEIT_BEGIN(cv_gemv);
+    cv::Mat cvgemv = cvmatab * cvvec;
+    TIMEIT_END(cv_gemv);
+    TIMEIT_PRINT(cv_gemv, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_gemv);
+    fkZQ::Matrix<float> pgemv = pmatab * pvec;
+    TIMEIT_END(fkZQ_gemv);
+    TIMEIT_PRINT(fkZQ_gemv, 0, 0);
+
+    assert_eq(cvgemv, pgemv);
+
+    TIMEIT_BEGIN(cv_gemv_t);
+    cv::Mat cvgemv_t = cvmatab.t() * cvvec_t;
+    TIMEIT_END(cv_gemv_t);
+    TIMEIT_PRINT(cv_gemv_t, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_gemv_t);
+    fkZQ::Matrix<float> pgemv_t = pmatab.gemv(pvec_t, true);
+    TIMEIT_END(fkZQ_gemv_t);
+    TIMEIT_PRINT(fkZQ_gemv_t, 0, 0);
+
+    assert_eq(cvgemv_t, pgemv_t);
+
+    const int BATCH = 4096, BS = 16;
+    cv::Mat cvbatch_a(BATCH * BS, BS, CV_32F);
+    cv::Mat cvbatch_b(BATCH * BS, BS, CV_32F);
+    cv::Mat cvbatch_c(BATCH * BS, BS, CV_32F);
+    cv::randu(cvbatch_a, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::randu(cvbatch_b, cv::Scalar::all(0), cv::Scalar::all(1));
+    std::vector<float> pbatch_c(BATCH * BS * BS);
+
+    TIMEIT_BEGIN(cv_gemm_batched);
+    for (int b = 0; b < BATCH; ++b)
+    {
+        cv::Mat c = cvbatch_a.rowRange(b * BS, (b + 1) * BS) * cvbatch_b.rowRange(b * BS, (b + 1) * BS);
+        c.copyTo(cvbatch_c.rowRange(b * BS, (b + 1) * BS));
+    }
+    TIMEIT_END(cv_gemm_batched);
+    TIMEIT_PRINT(cv_gemm_batched, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_gemm_batched);
+    fkZQ::gemm_batched<float>(BATCH, BS, BS, BS, (float *)cvbatch_a.data, (float *)cvbatch_b.data, pbatch_c.data());
+    TIMEIT_END(fkZQ_gemm_batched);
+    TIMEIT_PRINT(fkZQ_gemm_batched, 0, 0);
+
+    fkZQ::Matrix<float> pbatch(BATCH * BS, BS, pbatch_c.data(), false);
+    assert_eq(cvbatch_c, pbatch);
+
+    cv::Mat cvrhs(ROWS, 1, CV_32F);
+    cv::randu(cvrhs, cv::Scalar::all(0), cv::Scalar::all(1));
+    fkZQ::Matrix<float> prhs(ROWS, 1);
+    for (int i = 0; i < ROWS; ++i)
+        prhs.at(i, 0) = cvrhs.at<float>(i, 0);
+
+    cv::Mat cvsol;
+    TIMEIT_BEGIN(cv_solve_lu);
+    cv::solve(cvmataa, cvrhs, cvsol, cv::DECOMP_LU);
+    TIMEIT_END(cv_solve_lu);
+    TIMEIT_PRINT(cv_solve_lu, 0, 0);
+
+    fkZQ::Matrix<float> psol;
+    TIMEIT_BEGIN(fkZQ_solve_lu);
+    fkZQ::solve(pmataa, prhs, psol, fkZQ::DECOMP_LU);
+    TIMEIT_END(fkZQ_solve_lu);
+    TIMEIT_PRINT(fkZQ_solve_lu, 0, 0);
+
+    assert_eq(cvsol, psol);
+
+    cv::Mat cvspd = cvmataa * cvmataa.t() + cv::Mat::eye(ROWS, ROWS, CV_32F) * ROWS;
+    fkZQ::Matrix<float> pspd = pmataa * pmataa.transpose();
+    for (int i = 0; i < ROWS; ++i)
+        pspd.at(i, i) += ROWS;
+
+    TIMEIT_BEGIN(cv_solve_cholesky);
+    cv::solve(cvspd, cvrhs, cvsol, cv::DECOMP_CHOLESKY);
+    TIMEIT_END(cv_solve_cholesky);
+    TIMEIT_PRINT(cv_solve_cholesky, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_solve_cholesky);
+    fkZQ::solve(pspd, prhs, psol, fkZQ::DECOMP_CHOLESKY);
+    TIMEIT_END(fkZQ_solve_cholesky);
+    TIMEIT_PRINT(fkZQ_solve_cholesky, 0, 0);
+
+    assert_eq(cvsol, psol);
+
+    TIMEIT_BEGIN(cv_inverse);
+    cv::Mat cvinv = cvmataa.inv();
+    TIMEIT_END(cv_inverse);
+    TIMEIT_PRINT(cv_inverse, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_inverse);
+    fkZQ::Matrix<float> pinv = pmataa.inverse();
+    TIMEIT_END(fkZQ_inverse);
+    TIMEIT_PRINT(fkZQ_inverse, 0, 0);
+
+    assert_eq(cvinv, pinv);
+
     TIMEIT_BEGIN(cv_div);
     cv::Mat cvdiv = cvmatab / (cvmatab + 1);
     TIMEIT_END(cv_div);
@@ -133,6 +347,549 @@ int main(int argc, char const *argv[])
 
     assert_eq(cvbox, pbox);
 
+    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(31, 31));
+    cv::Mat cverode, cvdilate;
+    TIMEIT_BEGIN(cv_erode);
+    cv::erode(cvmatab, cverode, kernel, cv::Point(-1, -1), 1, cv::BORDER_REFLECT);
+    TIMEIT_END(cv_erode);
+    TIMEIT_PRINT(cv_erode, 0, 0);
+
+    fkZQ::Matrix<float> perode;
+    TIMEIT_BEGIN(fkZQ_erode);
+    erode_s(pmatab, perode, 31);
+    TIMEIT_END(fkZQ_erode);
+    TIMEIT_PRINT(fkZQ_erode, 0, 0);
+
+    assert_eq(cverode, perode);
+
+    TIMEIT_BEGIN(cv_dilate);
+    cv::dilate(cvmatab, cvdilate, kernel, cv::Point(-1, -1), 1, cv::BORDER_REFLECT);
+    TIMEIT_END(cv_dilate);
+    TIMEIT_PRINT(cv_dilate, 0, 0);
+
+    fkZQ::Matrix<float> pdilate;
+    TIMEIT_BEGIN(fkZQ_dilate);
+    dilate_s(pmatab, pdilate, 31);
+    TIMEIT_END(fkZQ_dilate);
+    TIMEIT_PRINT(fkZQ_dilate, 0, 0);
+
+    assert_eq(cvdilate, pdilate);
+
+    cv::Mat cvrgb(ROWS, COLS, CV_8UC3);
+    cv::randu(cvrgb, cv::Scalar::all(0), cv::Scalar::all(255));
+    fkZQ::Matrix<uchar> prgb(ROWS, COLS, 3);
+    for (int i = 0; i < ROWS; ++i)
+    {
+        memcpy(prgb.ptr(i), cvrgb.ptr<uchar>(i), COLS * 3);
+    }
+
+    std::vector<cv::Mat> cvplanes;
+    TIMEIT_BEGIN(cv_split);
+    cv::split(cvrgb, cvplanes);
+    TIMEIT_END(cv_split);
+    TIMEIT_PRINT(cv_split, 0, 0);
+
+    std::vector<fkZQ::Matrix<uchar>> pplanes;
+    TIMEIT_BEGIN(fkZQ_split);
+    fkZQ::split(prgb, pplanes);
+    TIMEIT_END(fkZQ_split);
+    TIMEIT_PRINT(fkZQ_split, 0, 0);
+
+    assert_eq(cvplanes[1], pplanes[1]);
+
+    cv::Mat cvmerged;
+    TIMEIT_BEGIN(cv_merge);
+    cv::merge(cvplanes, cvmerged);
+    TIMEIT_END(cv_merge);
+    TIMEIT_PRINT(cv_merge, 0, 0);
+
+    fkZQ::Matrix<uchar> pmerged;
+    TIMEIT_BEGIN(fkZQ_merge);
+    fkZQ::merge(pplanes, pmerged);
+    TIMEIT_END(fkZQ_merge);
+    TIMEIT_PRINT(fkZQ_merge, 0, 0);
+
+    assert_eq(cvmerged, pmerged);
+
+    cv::Mat cvrgbf;
+    TIMEIT_BEGIN(cv_convert_c3);
+    cvrgb.convertTo(cvrgbf, CV_32F);
+    TIMEIT_END(cv_convert_c3);
+    TIMEIT_PRINT(cv_convert_c3, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_convert_c3);
+    fkZQ::Matrix<float> prgbf = fkZQ::toType<float>(prgb);
+    TIMEIT_END(fkZQ_convert_c3);
+    TIMEIT_PRINT(fkZQ_convert_c3, 0, 0);
+
+    assert_eq(cvrgbf, prgbf);
+
+    cv::Mat cvbox_c3;
+    TIMEIT_BEGIN(cv_boxfilter_c3);
+    cv::boxFilter(cvrgbf, cvbox_c3, -1, cv::Size(5, 5), cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    TIMEIT_END(cv_boxfilter_c3);
+    TIMEIT_PRINT(cv_boxfilter_c3, 0, 0);
+
+    fkZQ::Matrix<float> pbox_c3;
+    TIMEIT_BEGIN(fkZQ_boxfilter_c3);
+    box_filter_s(prgbf, pbox_c3, 5);
+    TIMEIT_END(fkZQ_boxfilter_c3);
+    TIMEIT_PRINT(fkZQ_boxfilter_c3, 0, 0);
+
+    assert_eq(cvbox_c3, pbox_c3);
+
+    cv::Mat cvpyr;
+    TIMEIT_BEGIN(cv_pyrdown);
+    cv::pyrDown(cvmatab, cvpyr);
+    TIMEIT_END(cv_pyrdown);
+    TIMEIT_PRINT(cv_pyrdown, 0, 0);
+
+    fkZQ::Matrix<float> ppyr;
+    TIMEIT_BEGIN(fkZQ_pyrdown);
+    fkZQ::pyrDown(pmatab, ppyr);
+    TIMEIT_END(fkZQ_pyrdown);
+    TIMEIT_PRINT(fkZQ_pyrdown, 0, 0);
+
+    assert_eq(cvpyr, ppyr);
+
+    cv::Mat cvarea;
+    TIMEIT_BEGIN(cv_resize_area);
+    cv::resize(cvmatab, cvarea, cv::Size(COLS / 2, ROWS / 2), 0, 0, cv::INTER_AREA);
+    TIMEIT_END(cv_resize_area);
+    TIMEIT_PRINT(cv_resize_area, 0, 0);
+
+    fkZQ::Matrix<float> parea;
+    TIMEIT_BEGIN(fkZQ_resize_area);
+    fkZQ::resize(pmatab, parea, ROWS / 2, COLS / 2, fkZQ::INTER_AREA);
+    TIMEIT_END(fkZQ_resize_area);
+    TIMEIT_PRINT(fkZQ_resize_area, 0, 0);
+
+    assert_eq(cvarea, parea);
+
+    cv::Mat cvlinear;
+    TIMEIT_BEGIN(cv_resize_linear);
+    cv::resize(cvmatab, cvlinear, cv::Size(COLS * 2 / 3, ROWS * 3 / 4), 0, 0, cv::INTER_LINEAR);
+    TIMEIT_END(cv_resize_linear);
+    TIMEIT_PRINT(cv_resize_linear, 0, 0);
+
+    fkZQ::Matrix<float> plinear;
+    TIMEIT_BEGIN(fkZQ_resize_linear);
+    fkZQ::resize(pmatab, plinear, ROWS * 3 / 4, COLS * 2 / 3);
+    TIMEIT_END(fkZQ_resize_linear);
+    TIMEIT_PRINT(fkZQ_resize_linear, 0, 0);
+
+    assert_eq(cvlinear, plinear);
+
+    std::vector<cv::Mat> cvlevels(6);
+    TIMEIT_BEGIN(cv_pyramid_c3);
+    cvlevels[0] = cvrgb;
+    for (int l = 1; l < 6; ++l)
+    {
+        cv::pyrDown(cvlevels[l - 1], cvlevels[l]);
+    }
+    TIMEIT_END(cv_pyramid_c3);
+    TIMEIT_PRINT(cv_pyramid_c3, 0, 0);
+
+    std::vector<fkZQ::Matrix<uchar>> plevels;
+    TIMEIT_BEGIN(fkZQ_pyramid_c3);
+    fkZQ::buildPyramid(prgb, plevels, 5);
+    TIMEIT_END(fkZQ_pyramid_c3);
+    TIMEIT_PRINT(fkZQ_pyramid_c3, 0, 0);
+
+    assert_eq(cvlevels[5], plevels[5]);
+
+    cv::Mat cvkernel(31, 31, CV_32F);
+    cv::randu(cvkernel, cv::Scalar::all(0), cv::Scalar::all(1));
+    cvkernel = cvkernel / cv::sum(cvkernel)[0];
+    fkZQ::Matrix<float> pkernel(31, 31);
+    for (int i = 0; i < 31; ++i)
+    {
+        for (int j = 0; j < 31; ++j)
+        {
+            pkernel.at(i, j) = cvkernel.at<float>(i, j);
+        }
+    }
+
+    cv::Mat cvfilter;
+    TIMEIT_BEGIN(cv_filter2d);
+    cv::filter2D(cvmatab, cvfilter, -1, cvkernel);
+    TIMEIT_END(cv_filter2d);
+    TIMEIT_PRINT(cv_filter2d, 0, 0);
+
+    fkZQ::Matrix<float> pfilter;
+    TIMEIT_BEGIN(fkZQ_correlate_fft);
+    fkZQ::correlate(pmatab, pkernel, pfilter);
+    TIMEIT_END(fkZQ_correlate_fft);
+    TIMEIT_PRINT(fkZQ_correlate_fft, 0, 0);
+
+    assert_eq(cvfilter, pfilter);
+
+    cv::Mat cvfilter5;
+    cv::Mat cvkernel5 = cvkernel(cv::Rect(0, 0, 5, 5)).clone();
+    TIMEIT_BEGIN(cv_filter2d_5x5);
+    cv::filter2D(cvmatab, cvfilter5, -1, cvkernel5);
+    TIMEIT_END(cv_filter2d_5x5);
+    TIMEIT_PRINT(cv_filter2d_5x5, 0, 0);
+
+    fkZQ::Matrix<float> pkernel5(5, 5);
+    for (int i = 0; i < 5; ++i)
+    {
+        for (int j = 0; j < 5; ++j)
+        {
+            pkernel5.at(i, j) = pkernel(i, j);
+        }
+    }
+    fkZQ::Matrix<float> pfilter5;
+    TIMEIT_BEGIN(fkZQ_correlate_direct_5x5);
+    fkZQ::correlate(pmatab, pkernel5, pfilter5);
+    TIMEIT_END(fkZQ_correlate_direct_5x5);
+    TIMEIT_PRINT(fkZQ_correlate_direct_5x5, 0, 0);
+
+    assert_eq(cvfilter5, pfilter5);
+
+    cv::Mat cvscaled = cvmatab * (1.0 / 32);
+    fkZQ::Matrix<float> pscaled = pmatab * (1.0f / 32);
+
+    cv::Mat cvexp;
+    TIMEIT_BEGIN(cv_exp);
+    cv::exp(cvscaled, cvexp);
+    TIMEIT_END(cv_exp);
+    TIMEIT_PRINT(cv_exp, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_exp);
+    fkZQ::Matrix<float> pexp = fkZQ::exp(pscaled);
+    TIMEIT_END(fkZQ_exp);
+    TIMEIT_PRINT(fkZQ_exp, 0, 0);
+
+    assert_eq(cvexp, pexp);
+
+    cv::Mat cvlog;
+    TIMEIT_BEGIN(cv_log);
+    cv::log(cvmatab + 1, cvlog);
+    TIMEIT_END(cv_log);
+    TIMEIT_PRINT(cv_log, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_log);
+    fkZQ::Matrix<float> plog = fkZQ::log(pmatab + 1);
+    TIMEIT_END(fkZQ_log);
+    TIMEIT_PRINT(fkZQ_log, 0, 0);
+
+    assert_eq(cvlog, plog);
+
+    cv::Mat cvsqrt;
+    TIMEIT_BEGIN(cv_sqrt);
+    cv::sqrt(cvmatab, cvsqrt);
+    TIMEIT_END(cv_sqrt);
+    TIMEIT_PRINT(cv_sqrt, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_sqrt);
+    fkZQ::Matrix<float> psqrt = fkZQ::sqrt(pmatab);
+    TIMEIT_END(fkZQ_sqrt);
+    TIMEIT_PRINT(fkZQ_sqrt, 0, 0);
+
+    assert_eq(cvsqrt, psqrt);
+
+    cv::Mat cvpow;
+    TIMEIT_BEGIN(cv_pow);
+    cv::pow(cvscaled, 2.5, cvpow);
+    TIMEIT_END(cv_pow);
+    TIMEIT_PRINT(cv_pow, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_pow);
+    fkZQ::Matrix<float> ppow = fkZQ::pow(pscaled, 2.5);
+    TIMEIT_END(fkZQ_pow);
+    TIMEIT_PRINT(fkZQ_pow, 0, 0);
+
+    assert_eq(cvpow, ppow);
+
+    // a user lambda over simd<float>: x / (1 + |x|) in place, the row tails are padded vectors as well
+    cv::Mat cvsoftsign = cvscaled / (cv::abs(cvscaled) + 1);
+    fkZQ::Matrix<float> psoftsign = pscaled;
+    TIMEIT_BEGIN(fkZQ_apply);
+    fkZQ::apply(psoftsign, [](auto x) { return x / (fkZQ::vabs(x) + 1); });
+    TIMEIT_END(fkZQ_apply);
+    TIMEIT_PRINT(fkZQ_apply, 0, 0);
+
+    assert_eq(cvsoftsign, psoftsign);
+
+    // column means subtracted from every row, then every row scaled by the inverse of its maximum
+    TIMEIT_BEGIN(cv_normalize_features);
+    cv::Mat cvmean, cvcentered, cvrowmax, cvfeatures;
+    cv::reduce(cvmatab, cvmean, 0, cv::REDUCE_AVG);
+    cv::subtract(cvmatab, cv::repeat(cvmean, ROWS, 1), cvcentered);
+    cv::reduce(cvcentered, cvrowmax, 1, cv::REDUCE_MAX);
+    cvfeatures = cvcentered / cv::repeat(cvrowmax, 1, COLS);
+    TIMEIT_END(cv_normalize_features);
+    TIMEIT_PRINT(cv_normalize_features, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_normalize_features);
+    fkZQ::Matrix<float> pmean, pcentered, prowmax;
+    fkZQ::reduce(pmatab, pmean, 0, fkZQ::REDUCE_AVG);
+    fkZQ::broadcast(pcentered, pmatab, pmean, [](auto x, auto m) { return x - m; });
+    fkZQ::reduce(pcentered, prowmax, 1, fkZQ::REDUCE_MAX);
+    fkZQ::Matrix<float> pfeatures = fkZQ::broadcastDiv(pcentered, prowmax);
+    TIMEIT_END(fkZQ_normalize_features);
+    TIMEIT_PRINT(fkZQ_normalize_features, 0, 0);
+
+    assert_eq(cvmean, pmean);
+    assert_eq(cvrowmax, prowmax);
+    assert_eq(cvfeatures, pfeatures);
+
+    cv::Mat cvrowsum;
+    cv::reduce(cvmatab, cvrowsum, 1, cv::REDUCE_SUM, CV_64F);
+    fkZQ::Matrix<double> prowsum;
+    fkZQ::reduce(pmatab, prowsum, 1, fkZQ::REDUCE_SUM);
+    assert_eq(cvrowsum, prowsum);
+
+    // Gram matrix of the rows, and covariance of the rows as samples
+    TIMEIT_BEGIN(cv_gram);
+    cv::Mat cvgram;
+    cv::mulTransposed(cvmatab, cvgram, false);
+    TIMEIT_END(cv_gram);
+    TIMEIT_PRINT(cv_gram, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_syrk);
+    fkZQ::Matrix<float> pgram;
+    fkZQ::syrk(pmatab, pgram);
+    TIMEIT_END(fkZQ_syrk);
+    TIMEIT_PRINT(fkZQ_syrk, 0, 0);
+
+    assert_eq(cvgram, pgram);
+
+    TIMEIT_BEGIN(cv_covariance);
+    cv::Mat cvcovar, cvcovmean;
+    cv::calcCovarMatrix(cvmatab, cvcovar, cvcovmean, cv::COVAR_NORMAL | cv::COVAR_ROWS, CV_32F);
+    cvcovar = cvcovar / (ROWS - 1);
+    TIMEIT_END(cv_covariance);
+    TIMEIT_PRINT(cv_covariance, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_covariance);
+    fkZQ::Matrix<float> pcovar, pcovmean;
+    fkZQ::covariance(pmatab, pcovar, pcovmean);
+    TIMEIT_END(fkZQ_covariance);
+    TIMEIT_PRINT(fkZQ_covariance, 0, 0);
+
+    assert_eq(cvcovmean, pcovmean);
+    assert_eq(cvcovar, pcovar);
+
+    // aa * ab * ba * x, scaled to keep the products in range: left to right it is two matrix products and a
+    // matrix-vector product, the planner runs it right to left as three matrix-vector products
+    cv::Mat cvchaina = cvmataa / (255.0 * ROWS), cvchainb = cvmatab / (255.0 * COLS), cvchainc = cvmatba / (255.0 * ROWS);
+    cv::Mat cvchainx = cvmatab.colRange(0, 1) / 255.0;
+    fkZQ::Matrix<float> pchaina = pmataa * (1.0f / (255.0f * ROWS)), pchainb = pmatab * (1.0f / (255.0f * COLS));
+    fkZQ::Matrix<float> pchainc = pmatba * (1.0f / (255.0f * ROWS)), pchainx(ROWS, 1);
+    for (int i = 0; i < ROWS; ++i)
+    {
+        pchainx.at(i, 0) = pmatab.at(i, 0) / 255.0f;
+    }
+    TIMEIT_BEGIN(cv_chain);
+    cv::Mat cvchain = cvchaina * cvchainb * cvchainc * cvchainx;
+    TIMEIT_END(cv_chain);
+    TIMEIT_PRINT(cv_chain, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_multiply_chain);
+    fkZQ::Matrix<float> pchain = fkZQ::multiply_chain<float>({pchaina, pchainb, pchainc, pchainx});
+    TIMEIT_END(fkZQ_multiply_chain);
+    TIMEIT_PRINT(fkZQ_multiply_chain, 0, 0);
+
+    std::cout << "chain order " << fkZQ::plan_chain({(size_t)ROWS, (size_t)ROWS, (size_t)COLS, (size_t)ROWS, 1}, sizeof(float)).str() << std::endl;
+    assert_eq(cvchain, pchain);
+
+    // 128 patches of 32 x 32 from cvmatab scaled to [0, 1]: box filter, then the Gram matrix of each patch
+    const int PATCHES = 128, PATCH = 32;
+    std::vector<cv::Mat> cvpatches(PATCHES);
+    std::vector<fkZQ::Matrix<float>> ppatches(PATCHES);
+    for (int p = 0; p < PATCHES; ++p)
+    {
+        int r0 = p / (COLS / PATCH) * PATCH, c0 = p % (COLS / PATCH) * PATCH;
+        cvpatches[p] = cvmatab(cv::Rect(c0, r0, PATCH, PATCH)) / 255.0;
+        ppatches[p].create(PATCH, PATCH);
+        for (int i = 0; i < PATCH; ++i)
+        {
+            for (int j = 0; j < PATCH; ++j)
+            {
+                ppatches[p].at(i, j) = pmatab.at(r0 + i, c0 + j) / 255.0f;
+            }
+        }
+    }
+    TIMEIT_BEGIN(cv_patches);
+    cv::Mat cvpatchgram;
+    for (int p = 0; p < PATCHES; ++p)
+    {
+        cv::Mat blurred;
+        cv::boxFilter(cvpatches[p], blurred, -1, cv::Size(5, 5), cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+        cvpatchgram = blurred * blurred.t();
+    }
+    TIMEIT_END(cv_patches);
+    TIMEIT_PRINT(cv_patches, 0, 0);
+
+    fkZQ::MatrixBatch<float> ppatchbatch(ppatches), pblurred;
+    TIMEIT_BEGIN(fkZQ_batch);
+    box_filter_s(ppatchbatch, pblurred, 5);
+    fkZQ::MatrixBatch<float> pgrams = pblurred * pblurred.transpose();
+    TIMEIT_END(fkZQ_batch);
+    TIMEIT_PRINT(fkZQ_batch, 0, 0);
+
+    fkZQ::Matrix<float> ppatchgram = pgrams[PATCHES - 1].clone();
+    assert_eq(cvpatchgram, ppatchgram);
+
+    // about 1% of cvmatab kept, the dense products are the reference
+    cv::Mat cvsparse = cv::Mat::zeros(ROWS, COLS, CV_32F);
+    fkZQ::Matrix<float> psparse(ROWS, COLS);
+    for (int i = 0; i < ROWS; ++i)
+    {
+        for (int j = 0; j < COLS; ++j)
+        {
+            if (cvmatab.at<float>(i, j) < 2.55f)
+            {
+                cvsparse.at<float>(i, j) = cvmatab.at<float>(i, j);
+                psparse.at(i, j) = cvmatab.at<float>(i, j);
+            }
+        }
+    }
+
+    TIMEIT_BEGIN(fkZQ_csr_from_dense);
+    fkZQ::CsrMatrix<float> pcsr(psparse);
+    TIMEIT_END(fkZQ_csr_from_dense);
+    TIMEIT_PRINT(fkZQ_csr_from_dense, 0, 0);
+    std::cout << "csr nnz: " << pcsr.nnz() << std::endl;
+
+    TIMEIT_BEGIN(cv_dense_spmv);
+    cv::Mat cvspmv = cvsparse * cvvec;
+    TIMEIT_END(cv_dense_spmv);
+    TIMEIT_PRINT(cv_dense_spmv, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_spmv);
+    fkZQ::Matrix<float> pspmv = pcsr.gemv(pvec);
+    TIMEIT_END(fkZQ_spmv);
+    TIMEIT_PRINT(fkZQ_spmv, 0, 0);
+
+    assert_eq(cvspmv, pspmv);
+
+    TIMEIT_BEGIN(cv_dense_spmm);
+    cv::Mat cvspmm = cvsparse * cvmatba;
+    TIMEIT_END(cv_dense_spmm);
+    TIMEIT_PRINT(cv_dense_spmm, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_spmm);
+    fkZQ::Matrix<float> pspmm = pcsr * pmatba;
+    TIMEIT_END(fkZQ_spmm);
+    TIMEIT_PRINT(fkZQ_spmm, 0, 0);
+
+    assert_eq(cvspmm, pspmm);
+
+    TIMEIT_BEGIN(fkZQ_csr_transpose);
+    fkZQ::CsrMatrix<float> pcsr_t = pcsr.transpose();
+    TIMEIT_END(fkZQ_csr_transpose);
+    TIMEIT_PRINT(fkZQ_csr_transpose, 0, 0);
+
+    cv::Mat cvsparse_t = cvsparse.t();
+    fkZQ::Matrix<float> psparse_t = pcsr_t.toDense();
+    assert_eq(cvsparse_t, psparse_t);
+
+    // box filter, high-pass and projection of independent frames, each op small enough to run serially
+    const int FRAMES = 8;
+    std::vector<cv::Mat> cvframes(FRAMES);
+    TIMEIT_BEGIN(cv_frames);
+    for (int f = 0; f < FRAMES; ++f)
+    {
+        cv::Mat frame = cvmatab + f, blurred;
+        cv::boxFilter(frame, blurred, -1, cv::Size(5, 5), cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+        cvframes[f] = (frame - blurred) * cvmatba;
+    }
+    TIMEIT_END(cv_frames);
+    TIMEIT_PRINT(cv_frames, 0, 0);
+
+    TIMEIT_BEGIN(fkZQ_task_graph);
+    fkZQ::TaskGraph graph;
+    fkZQ::Task<fkZQ::Matrix<float>> proj = graph.input(pmatba);
+    std::vector<fkZQ::Task<fkZQ::Matrix<float>>> pframes;
+    for (int f = 0; f < FRAMES; ++f)
+    {
+        auto frame = graph.input(pmatab + (float)f);
+        auto blurred = fkZQ::asyncBoxFilter<float>(graph, frame, 5);
+        pframes.push_back(fkZQ::asyncMultiply(graph, fkZQ::asyncSub(graph, frame, blurred), proj));
+    }
+    graph.wait();
+    TIMEIT_END(fkZQ_task_graph);
+    TIMEIT_PRINT(fkZQ_task_graph, 0, 0);
+
+    cv::Mat cvlastframe = cvframes.back();
+    fkZQ::Matrix<float> plastframe = pframes.back().get();
+    assert_eq(cvlastframe, plastframe);
+
+    // the product of the first test, streamed through temporary files with a budget far below the operands
+    std::filesystem::path tmpdir = std::filesystem::temp_directory_path();
+    std::string pathab = (tmpdir / "fkzq_ooc_a.bin").string(), pathba = (tmpdir / "fkzq_ooc_b.bin").string(), pathc = (tmpdir / "fkzq_ooc_c.bin").string();
+    {
+        fkZQ::MatrixFile<float> fab(pathab, ROWS, COLS, true), fba(pathba, COLS, ROWS, true);
+        fab.write(0, 0, pmatab);
+        fba.write(0, 0, pmatba);
+    }
+    fkZQ::OocStats oocstats;
+    TIMEIT_BEGIN(fkZQ_gemm_ooc);
+    {
+        fkZQ::MatrixFile<float> fab(pathab, ROWS, COLS), fba(pathba, COLS, ROWS), fc(pathc, ROWS, ROWS, true);
+        fkZQ::gemm_ooc(fab, fba, fc, (size_t)ROWS * COLS, &oocstats);
+    }
+    TIMEIT_END(fkZQ_gemm_ooc);
+    TIMEIT_PRINT(fkZQ_gemm_ooc, 0, 0);
+    std::cout << "gemm_ooc: tiles " << oocstats.tile_m << "x" << oocstats.tile_n << "x" << oocstats.tile_k << ", I/O "
+              << oocstats.ioGBps() << " GB/s, compute " << oocstats.computeGflops() << " GFLOP/s, stalled "
+              << oocstats.stall_seconds << " of " << oocstats.wall_seconds << " s" << std::endl;
+
+    fkZQ::Matrix<float> pooc(ROWS, ROWS);
+    {
+        fkZQ::MatrixFile<float> fc(pathc, ROWS, ROWS);
+        fc.read(0, 0, pooc);
+    }
+    assert_eq(cvmatmul, pooc);
+    std::filesystem::remove(pathab);
+    std::filesystem::remove(pathba);
+    std::filesystem::remove(pathc);
+
+    // publish a frame into shared memory and read it back without a copy, as a subscribing process would
+    fkZQ::SharedMatrix<float> publisher = fkZQ::SharedMatrix<float>::create("fkzq_main", ROWS, COLS);
+    fkZQ::SharedMatrix<float> subscriber = fkZQ::SharedMatrix<float>::attach("fkzq_main");
+    TIMEIT_BEGIN(fkZQ_shm_publish);
+    publisher.publish(pmatab);
+    TIMEIT_END(fkZQ_shm_publish);
+    TIMEIT_PRINT(fkZQ_shm_publish, 0, 0);
+
+    fkZQ::Matrix<float> pshared;
+    uint64_t frame = subscriber.latest(pshared);
+    assert_eq(cvmatab, pshared);
+    std::cout << "shared frame " << frame << (subscriber.valid(frame) ? " complete" : " overwritten") << std::endl;
+
+    // moving average of the last 8 frames of a sequence, box filtered: opencv re-sums the window for every frame,
+    // the temporal filter adds the new frame and drops the oldest
+    const int WINDOW = 8, SEQUENCE = 24;
+    std::vector<cv::Mat> cvsequence;
+    cv::Mat cvwindow, cvtemporal;
+    TIMEIT_BEGIN(cv_temporal);
+    for (int f = 0; f < SEQUENCE; ++f)
+    {
+        cvsequence.push_back(cvmatab + (float)f);
+        int first = std::max(0, f + 1 - WINDOW);
+        cvwindow = cvsequence[first].clone();
+        for (int g = first + 1; g <= f; ++g)
+            cvwindow += cvsequence[g];
+        cvwindow /= (float)(f + 1 - first);
+        cv::boxFilter(cvwindow, cvtemporal, -1, cv::Size(5, 5), cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    }
+    TIMEIT_END(cv_temporal);
+    TIMEIT_PRINT(cv_temporal, 0, 0);
+
+    TemporalFilter<float> ptemporalfilter(WINDOW, 5);
+    fkZQ::Matrix<float> ptemporal;
+    TIMEIT_BEGIN(fkZQ_temporal);
+    for (int f = 0; f < SEQUENCE; ++f)
+        ptemporalfilter.push(pmatab + (float)f, ptemporal);
+    TIMEIT_END(fkZQ_temporal);
+    TIMEIT_PRINT(fkZQ_temporal, 0, 0);
+
+    assert_eq(cvtemporal, ptemporal);
+
     std::cout << "done" << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "matrix.impl.hpp"
+#include "sparse.impl.hpp"
 
 namespace fkZQ
 {
@@ -10,4 +11,21 @@ namespace fkZQ
     template class Matrix<unsigned short>;
     template class Matrix<char>;
     template class Matrix<unsigned char>;
+
+    template class CooMatrix<float>;
+    template class CooMatrix<double>;
+    template class CooMatrix<int>;
+    template class CooMatrix<unsigned int>;
+    template class CooMatrix<short>;
+    template class CooMatrix<unsigned short>;
+    template class CooMatrix<char>;
+    template class CooMatrix<unsigned char>;
+    template class CsrMatrix<float>;
+    template class CsrMatrix<double>;
+    template class CsrMatrix<int>;
+    template class CsrMatrix<unsigned int>;
+    template class CsrMatrix<short>;
+    template class CsrMatrix<unsigned short>;
+    template class CsrMatrix<char>;
+    template class CsrMatrix<unsigned char>;
 }
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+#include "matrix.h"
+#include "gemm.hpp"
+#include "boxfilter.hpp"
+
+// searches the kernel parameters of fkZQ::KernelParams on this machine and writes them to the config file the
+// library loads at startup:
+//   tune [config path] [--quick] [--strassen]
+// the path defaults to FKZQ_TUNE_FILE. parameters pinned at build time are reported and left alone. Strassen is
+// timed and its error reported either way, but only enabled with --strassen
+
+// best wall time of reps runs of f in ms, after one warm-up run
+template <typename F>
+double BestOf(int reps, F f)
+{
+    f();
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        std::chrono::duration<double, std::milli> d = std::chrono::high_resolution_clock::now() - start;
+        best = std::min(best, d.count());
+    }
+    return best;
+}
+
+// sets *field to each candidate in turn and keeps the fastest
+template <typename F>
+size_t Search(const char *name, size_t *field, const std::vector<size_t> &candidates, int reps, F run)
+{
+    size_t best = *field;
+    double best_ms = BestOf(reps, run);
+    std::cout << "  " << name << " = " << best << ": " << best_ms << " ms (current)" << std::endl;
+    for (size_t c : candidates)
+    {
+        if (c == best)
+            continue;
+        *field = c;
+        double ms = BestOf(reps, run);
+        std::cout << "  " << name << " = " << c << ": " << ms << " ms" << std::endl;
+        if (ms < best_ms)
+        {
+            best_ms = ms;
+            best = c;
+        }
+    }
+    *field = best;
+    return best;
+}
+
+template <typename T>
+void TuneGemm(fkZQ::KernelParams &p, int shape, size_t n, int reps)
+{
+    fkZQ::Matrix<T> a(n, n), b(n, n), c(n, n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            a.at(i, j) = T((i + j) % 7);
+            b.at(i, j) = T((i * j) % 5);
+        }
+    }
+    auto run = [&]
+    { fkZQ::gemm(n, n, n, T(1), a.data(), a.step, b.data(), b.step, false, T(0), c.data(), c.step); };
+    fkZQ::GemmBlocks &blk = p.gemm[fkZQ::TypeClass(sizeof(T))][shape];
+    std::string name = std::string("gemm.") + fkZQ::TypeClassName(fkZQ::TypeClass(sizeof(T))) + (shape == fkZQ::GEMM_SMALL ? ".small" : ".large");
+    std::cout << name << " (" << n << "^3)" << std::endl;
+    // coordinate descent: the depth first, it sets the L1 footprint the other two are sized around
+#ifndef FKZQ_GEMM_KC
+    Search((name + ".kc").c_str(), &blk.kc, {64, 128, 192, 256, 384, 512}, reps, run);
+#endif
+#ifndef FKZQ_GEMM_MC
+    Search((name + ".mc").c_str(), &blk.mc, {32, 64, 96, 128, 192, 256, 384}, reps, run);
+#endif
+#ifndef FKZQ_GEMM_NC
+    Search((name + ".nc").c_str(), &blk.nc, {512, 1024, 2048, 4096, 8192}, reps, run);
+#endif
+}
+
+template <typename T>
+void TuneTranspose(fkZQ::KernelParams &p, size_t n, int reps)
+{
+    fkZQ::Matrix<T> a(n, n);
+    int c = fkZQ::TypeClass(sizeof(T));
+    std::cout << "transpose." << fkZQ::TypeClassName(c) << " (" << n << "x" << n << ")" << std::endl;
+    Search((std::string("transpose.") + fkZQ::TypeClassName(c) + ".block").c_str(), &p.transpose_block[c], {8, 16, 32, 64, 128}, reps,
+           [&]
+           { fkZQ::Matrix<T> t = a.transpose(); });
+}
+
+template <typename ST>
+void TuneBoxFilter(fkZQ::KernelParams &p, size_t rows, size_t cols, int reps)
+{
+    fkZQ::Matrix<float> img(rows, cols);
+    fkZQ::Matrix<ST> out;
+    int c = fkZQ::TypeClass(sizeof(ST));
+    std::cout << "box_filter." << fkZQ::TypeClassName(c) << " (" << rows << "x" << cols << ", 5x5)" << std::endl;
+    Search((std::string("box_filter.") + fkZQ::TypeClassName(c) + ".strip").c_str(), &p.box_strip[c], {0, 16, 32, 64, 128, 256}, reps,
+           [&]
+           { box_filter_s(img, out, 5); });
+}
+
+// Strassen-Winograd against gemm on n x n products for each threshold: the time and the relative Frobenius error
+// of the result, measured against a double precision gemm. with enable, the fastest threshold is kept if it beats
+// gemm, otherwise the multiply stays classical
+template <typename T>
+void TuneStrassen(fkZQ::KernelParams &p, size_t n, int reps, bool enable)
+{
+    int c = fkZQ::TypeClass(sizeof(T));
+    std::string name = std::string("gemm.") + fkZQ::TypeClassName(c) + ".strassen";
+    std::cout << name << " (" << n << "^3)" << std::endl;
+#ifdef FKZQ_STRASSEN_THRESHOLD
+    std::cout << "  pinned at build time" << std::endl;
+#else
+    fkZQ::Matrix<T> a(n, n), b(n, n), r(n, n);
+    fkZQ::Matrix<double> ad(n, n), bd(n, n), exact(n, n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            // values in [-1, 1) with a full mantissa, so rounding shows
+            a.at(i, j) = T(std::sin(1.0 + i * 0.7 + j * 1.3));
+            b.at(i, j) = T(std::cos(2.0 + i * 1.1 - j * 0.3));
+            ad.at(i, j) = a.at(i, j);
+            bd.at(i, j) = b.at(i, j);
+        }
+    }
+    fkZQ::gemm(n, n, n, 1.0, ad.data(), ad.step, bd.data(), bd.step, false, 0.0, exact.data(), exact.step);
+    auto error = [&]
+    {
+        double diff = 0, norm = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                double d = r.at(i, j) - exact.at(i, j);
+                diff += d * d;
+                norm += exact.at(i, j) * exact.at(i, j);
+            }
+        }
+        return std::sqrt(diff / norm);
+    };
+    double best_ms = BestOf(reps, [&]
+                            { fkZQ::gemm(n, n, n, T(1), a.data(), a.step, b.data(), b.step, false, T(0), r.data(), r.step); });
+    size_t best = 0;
+    std::cout << "  " << name << " = 0: " << best_ms << " ms, error " << error() << std::endl;
+    for (size_t t = 128; t <= n; t *= 2)
+    {
+        double ms = BestOf(reps, [&]
+                           { fkZQ::strassen(n, n, n, a.data(), a.step, b.data(), b.step, r.data(), r.step, t); });
+        std::cout << "  " << name << " = " << t << ": " << ms << " ms, error " << error() << std::endl;
+        if (ms < best_ms)
+        {
+            best_ms = ms;
+            best = t;
+        }
+    }
+    if (enable)
+        p.strassen[c] = best;
+    else
+        std::cout << "  fastest " << best << ", kept at " << p.strassen[c] << " (--strassen enables it)" << std::endl;
+#endif
+}
+
+// smallest elementwise size at which the parallel kernel beats the serial one by 10%
+void TuneParallelThreshold(fkZQ::KernelParams &p, int reps)
+{
+    std::cout << "parallel_threshold" << std::endl;
+#ifdef FKZQ_PARALLEL_THRESHOLD_PINNED
+    std::cout << "  pinned at build time" << std::endl;
+#else
+    if (omp_get_max_threads() == 1)
+    {
+        std::cout << "  one thread, kept at " << p.parallel_threshold << std::endl;
+        return;
+    }
+    size_t found = (size_t)1 << 24;
+    for (size_t n = 1 << 10; n <= ((size_t)1 << 22); n <<= 1)
+    {
+        // rows of 1024 so the parallel loop has rows to share
+        fkZQ::Matrix<float> x(n / 1024, 1024), y(n / 1024, 1024);
+        p.parallel_threshold = (size_t)-1;
+        double serial = BestOf(reps, [&]
+                               { fkZQ::Matrix<float> r = x + y; });
+        p.parallel_threshold = 0;
+        double parallel = BestOf(reps, [&]
+                                 { fkZQ::Matrix<float> r = x + y; });
+        std::cout << "  " << n << " elements: serial " << serial << " ms, parallel " << parallel << " ms" << std::endl;
+        if (parallel * 1.1 < serial)
+        {
+            found = n;
+            break;
+        }
+    }
+    p.parallel_threshold = found;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = fkZQ::KernelParams::configPath();
+    bool quick = false, strassen = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = true;
+        else if (strcmp(argv[i], "--strassen") == 0)
+            strassen = true;
+        else
+            path = argv[i];
+    }
+    int reps = quick ? 2 : 5;
+    fkZQ::KernelParams &p = fkZQ::Params();
+    // start from the cache-derived defaults, not from a config an earlier run left behind
+    p = fkZQ::KernelParams::defaults();
+    p.pin();
+    std::cout << "L1 " << fkZQ::CacheSize(1) / 1024 << " KB, L2 " << fkZQ::CacheSize(2) / 1024 << " KB, L3 "
+              << fkZQ::CacheSize(3) / 1024 << " KB, " << omp_get_max_threads() << " threads" << std::endl;
+
+    TuneParallelThreshold(p, reps);
+    TuneGemm<float>(p, fkZQ::GEMM_SMALL, 192, reps);
+    TuneGemm<float>(p, fkZQ::GEMM_LARGE, quick ? 512 : 1024, reps);
+    TuneGemm<double>(p, fkZQ::GEMM_SMALL, 192, reps);
+    TuneGemm<double>(p, fkZQ::GEMM_LARGE, quick ? 512 : 1024, reps);
+    TuneTranspose<unsigned char>(p, 2048, reps);
+    TuneTranspose<unsigned short>(p, 2048, reps);
+    TuneTranspose<float>(p, 2048, reps);
+    TuneTranspose<double>(p, 2048, reps);
+    TuneBoxFilter<float>(p, quick ? 1080 : 2160, quick ? 1920 : 3840, reps);
+    TuneBoxFilter<double>(p, quick ? 1080 : 2160, quick ? 1920 : 3840, reps);
+    TuneStrassen<float>(p, quick ? 1024 : 4096, quick ? 1 : 2, strassen);
+    TuneStrassen<double>(p, quick ? 1024 : 4096, quick ? 1 : 2, strassen);
+
+    if (!p.save(path))
+    {
+        std::cerr << "cannot write " << path << std::endl;
+        return 1;
+    }
+    std::cout << "written to " << path << ":" << std::endl;
+    p.print(std::cout);
+    return 0;
+}